@@ -0,0 +1,291 @@
+//bench.c
+//Headless timing of the renderer, no SDL needed
+
+#include "scene.h"
+#include "scenes.h"
+#include "scene_edit.h"
+#include "deferred.h"
+#include "vec_math.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "err_print.h"
+#include <time.h>
+
+static double timediff(struct timespec t1, struct timespec t2){
+	return (t2.tv_sec - t1.tv_sec) + 1e-9 * (t2.tv_nsec - t1.tv_nsec);
+}
+
+typedef struct {
+	size_t w, h;
+	size_t frames;
+	size_t threads;
+} Bench_Config;
+
+//Milliseconds of real time per frame
+static double Bench_Frame( const Scene scene, const Camera camera, float* const pixels, const Bench_Config config, Scene_Stats *const stats){
+	struct timespec t1, t2;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for(size_t i = 0; i < config.frames; i++)
+		*stats = Parallel_Scene_Project(scene, camera, pixels, config.threads);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	return 1e3 * timediff(t1, t2) / config.frames;
+}
+
+static void Bench_Quality( const Bench_Config config, float* const pixels){
+	static const char* const names[SCENE_QUALITIES] = {
+		[SCENE_QUALITY_FLAT] = "flat",
+		[SCENE_QUALITY_OCCLUSION] = "occlusion",
+		[SCENE_QUALITY_INDIRECT_LOW] = "indirect low",
+		[SCENE_QUALITY_INDIRECT_HIGH] = "indirect high"};
+	Scene scene;
+	if(!Scenes_Demo(&scene)) return;
+	const Camera camera = Scenes_DemoCamera(config.w, config.h);
+	double base = 0.0;
+	Scene_Stats stats;
+	printf("quality:\n");
+	for(size_t q = 0; q < SCENE_QUALITIES; q++){
+		Scene_SetQuality(&scene, q);
+		const double ms = Bench_Frame(scene, camera, pixels, config, &stats);
+		if(SCENE_QUALITY_FLAT == q) base = ms;
+		printf("  %-14s %9.2f ms/frame  %+9.2f ms\n", names[q], ms, ms - base);
+	}
+	Scene_Destroy(&scene);
+}
+
+static void Bench_Trace( const Bench_Config config, float* const pixels){
+	static const size_t budgets[] = {0, 1, 2, 4, 8, 16};
+	Scene scene;
+	if(!Scenes_Reflective(&scene)) return;
+	const Camera camera = Scenes_DemoCamera(config.w, config.h);
+	double base = 0.0;
+	Scene_Stats stats;
+	printf("ray budget:\n");
+	for(size_t b = 0; b < sizeof budgets / sizeof *budgets; b++){
+		scene.trace.rayBudget = budgets[b];
+		const double ms = Bench_Frame(scene, camera, pixels, config, &stats);
+		if(!b) base = ms;
+		printf("  %-14zu %9.2f ms/frame  %+9.2f ms  %9zu secondary  %9zu dropped\n",
+				budgets[b], ms, ms - base, stats.secondaryRays, stats.droppedRays);
+	}
+	Scene_Destroy(&scene);
+}
+
+static void Bench_Lights( const Bench_Config config, float* const pixels){
+	static const size_t counts[] = {1, 64, 1024};
+	static const char* const names[] = {"all", "culled", "culled+8"};
+	Scene_Stats stats;
+	printf("lights:\n");
+	for(size_t c = 0; c < sizeof counts / sizeof *counts; c++){
+		Scene scene;
+		if(!Scenes_ManyLights(&scene, counts[c])) return;
+		const Camera camera = Scenes_DemoCamera(config.w, config.h);
+		double base = 0.0;
+		for(size_t m = 0; m < sizeof names / sizeof *names; m++){
+			if(m >= 1){
+				scene.lightSampling.cutoff = 0.02;
+				if(!Scene_BuildLightGrid(&scene, 16)) break;
+			}
+			if(m >= 2)
+				scene.lightSampling.samples = 8;
+			const double ms = Bench_Frame(scene, camera, pixels, config, &stats);
+			if(!m) base = ms;
+			printf("  %5zu %-8s %9.2f ms/frame  %+9.2f ms\n", counts[c], names[m], ms, ms - base);
+		}
+		Scene_Destroy(&scene);
+	}
+}
+
+//Demo scene placed far from the world zero, rendered with world coordinates and rebased to the camera
+static void Bench_World( const Bench_Config config, float* const pixels){
+	const size_t n = 3 * config.w * config.h;
+	float* reference = malloc(n * sizeof *reference);
+	Scene scene;
+	if(!reference || !Scenes_Demo(&scene)){
+		free(reference);
+		return;
+	}
+	Camera camera = Scenes_DemoCamera(config.w, config.h);
+	const Vec3d far = {{1e4, 0.0, 1e4}};
+	Scene_Stats stats;
+	printf("large world:\n");
+	const double base = Bench_Frame(scene, camera, reference, config, &stats);
+	printf("  %-14s %9.2f ms/frame\n", "near zero", base);
+
+	scene.origin = far;
+	scene.bound = 2e4;
+	static const char* const names[] = {"world coords", "rebased"};
+	for(size_t m = 0; m < 2; m++){
+		if(!m){
+			Scene_Rebase(&scene, (Vec3d){0});
+			camera.position = Vec3dToVec3(far);
+		}else{
+			Scene_Rebase(&scene, far);
+			camera.position = (Vec3){0};
+		}
+		const double ms = Bench_Frame(scene, camera, pixels, config, &stats);
+		double error = 0.0;
+		for(size_t i = 0; i < n; i++)
+			error += fabs(pixels[i] - reference[i]);
+		printf("  %-14s %9.2f ms/frame  %+9.2f ms  %9.5f mean abs error\n", names[m], ms, ms - base, error / n);
+	}
+	Scene_Destroy(&scene);
+	free(reference);
+}
+
+//Sphere traces the demo floor and balls with one kernel type, the renderer itself only runs in Real
+#define DEF_BENCH_MARCH(scalar, vec) \
+	static inline scalar Bench_Distance_##vec( const vec point){\
+		static const vec centers[2] = {{{0.0, 0.0, 8.5}}, {{0.0, -1.0, 9.0}}};\
+		static const scalar radii[2] = {0.2, 0.5};\
+		scalar dist = point.x[1] + 3.0;\
+		for(size_t b = 0; b < 2; b++){\
+			const scalar d = vec##Norm(vec##Sub(point, centers[b])) - radii[b];\
+			if(d < dist) dist = d;\
+		}\
+		return dist;\
+	}\
+	\
+	static double Bench_March_##vec( const Camera camera, const size_t frames, size_t *const steps){\
+		struct timespec t1, t2;\
+		size_t count = 0;\
+		clock_gettime(CLOCK_MONOTONIC, &t1);\
+		for(size_t f = 0; f < frames; f++){\
+			for(size_t p = 0; p < camera.w * camera.h; p++){\
+				Vec3 start, direction;\
+				Camera_PrimaryRay(camera, p % camera.w, p / camera.w, &start, &direction);\
+				vec point = {{start.x[0], start.x[1], start.x[2]}};\
+				const vec dir = {{direction.x[0], direction.x[1], direction.x[2]}};\
+				for(size_t s = 0; s < Scene_Steps; s++, count++){\
+					const scalar dist = Bench_Distance_##vec(point);\
+					if(dist < (scalar)Scene_Eps_in || vec##Norm(point) > 100.0) break;\
+					point = vec##Add(point, vec##Mul(dir, dist * (scalar)Scene_March_Coeff));\
+				}\
+			}\
+		}\
+		clock_gettime(CLOCK_MONOTONIC, &t2);\
+		*steps = count;\
+		return 1e3 * timediff(t1, t2) / frames;\
+	}
+
+DEF_BENCH_MARCH(float, Vec3f)
+DEF_BENCH_MARCH(double, Vec3d)
+
+//Cost of the double kernels against the float ones within one run, single threaded primary rays only
+static void Bench_Precision( const Bench_Config config){
+	const Camera camera = Scenes_DemoCamera(config.w, config.h);
+	size_t steps[2];
+	printf("kernel precision:\n");
+	const double ms_float = Bench_March_Vec3f(camera, config.frames, &steps[0]);
+	const double ms_double = Bench_March_Vec3d(camera, config.frames, &steps[1]);
+	printf("  %-14s %9.2f ms/frame  %10zu steps\n", "float", ms_float, steps[0]);
+	printf("  %-14s %9.2f ms/frame  %10zu steps  %+9.2f ms\n", "double", ms_double, steps[1], ms_double - ms_float);
+}
+
+//Moves the small demo ball every frame, full frame against dirty tiles only
+static void Bench_Edit( const Bench_Config config, float* const pixels){
+	Scene scene;
+	Scene_Editor editor;
+	if(!Scenes_Demo(&scene)) return;
+	if(!Scene_EditorCreate(&editor, &scene)){
+		Scene_Destroy(&scene);
+		return;
+	}
+	const Camera camera = Scenes_DemoCamera(config.w, config.h);
+	const Scene_Handle small = 2;
+	Scene_Stats stats;
+	const double full = Bench_Frame(scene, camera, pixels, config, &stats);
+	Scene_EditorRender(&editor, camera, pixels, config.threads);
+
+	struct timespec t1, t2;
+	size_t tiles = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for(size_t i = 0; i < config.frames; i++){
+		Body body = Bodies_get(&scene.bodies, Scene_EditorBodyIndex(&editor, small));
+		body.shape.ball.center.x[0] += 0.05;
+		Scene_EditorUpdateBody(&editor, small, body);
+		tiles += Scene_EditorRender(&editor, camera, pixels, config.threads);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	const double ms = 1e3 * timediff(t1, t2) / config.frames;
+	const size_t total = Camera_TilesX(camera, SCENE_EDIT_TILE) * Camera_TilesY(camera, SCENE_EDIT_TILE);
+	printf("edit:\n");
+	printf("  %-14s %9.2f ms/frame\n", "full", full);
+	printf("  %-14s %9.2f ms/frame  %+9.2f ms  %9.1f of %zu tiles\n", "incremental", ms, ms - full, (double)tiles / config.frames, total);
+	Scene_EditorDestroy(&editor);
+	Scene_Destroy(&scene);
+}
+
+//Forward against the two pass path, with the time split between marching and shading
+static void Bench_Deferred( const Bench_Config config, float* const pixels){
+	static const char* const names[] = {"demo", "reflective", "64 lights"};
+	GBuffer gbuffer;
+	if(!GBuffer_Create(&gbuffer, config.w, config.h)) return;
+	const Camera camera = Scenes_DemoCamera(config.w, config.h);
+	Scene_Stats stats;
+	printf("deferred:\n");
+	for(size_t c = 0; c < sizeof names / sizeof *names; c++){
+		Scene scene;
+		bool ok;
+		switch(c){
+		case 0: 
+			ok = Scenes_Demo(&scene);
+			break;
+		case 1:
+			ok = Scenes_Reflective(&scene);
+			break;
+		default:
+			ok = Scenes_ManyLights(&scene, 64);
+			scene.lightSampling.cutoff = 0.02;
+			scene.lightSampling.samples = 8;
+			ok = ok && Scene_BuildLightGrid(&scene, 16);
+			break;
+		}
+		if(!ok) break;
+		const double forward = Bench_Frame(scene, camera, pixels, config, &stats);
+		struct timespec t1, t2, t3;
+		double march = 0.0, shade = 0.0;
+		for(size_t i = 0; i < config.frames; i++){
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			Parallel_Scene_March(scene, camera, &gbuffer, config.threads);
+			clock_gettime(CLOCK_MONOTONIC, &t2);
+			Parallel_GBuffer_Shade(scene, camera, &gbuffer, pixels, config.threads);
+			clock_gettime(CLOCK_MONOTONIC, &t3);
+			march += timediff(t1, t2);
+			shade += timediff(t2, t3);
+		}
+		march *= 1e3 / config.frames;
+		shade *= 1e3 / config.frames;
+		printf("  %-14s forward %9.2f ms  deferred %9.2f ms (march %9.2f, shade %9.2f)  %+9.2f ms\n",
+				names[c], forward, march + shade, march, shade, march + shade - forward);
+		Scene_Destroy(&scene);
+	}
+	GBuffer_Destroy(&gbuffer);
+}
+
+int main( int argc, char** argv){
+	Bench_Config config = {.w = 320, .h = 200, .frames = 4, .threads = 16};
+	if(argc > 1) config.w = strtoul(argv[1], NULL, 10);
+	if(argc > 2) config.h = strtoul(argv[2], NULL, 10);
+	if(argc > 3) config.frames = strtoul(argv[3], NULL, 10);
+	if(argc > 4) config.threads = strtoul(argv[4], NULL, 10);
+	if(!config.w || !config.h || !config.frames || !config.threads){
+		fprintf(stderr, "usage: %s [w h frames threads]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	float* pixels = malloc(3 * config.w * config.h * sizeof *pixels);
+	if(!pixels){
+		ERR_PRINT("Error while allocating pixels");
+		return EXIT_FAILURE;
+	}
+	printf("%zux%zu, %zu frames, %zu threads, %s\n", config.w, config.h, config.frames, config.threads,
+			(sizeof(Real) == sizeof(double)) ? "double" : "float");
+	Bench_Quality(config, pixels);
+	Bench_Trace(config, pixels);
+	Bench_Lights(config, pixels);
+	Bench_Precision(config);
+	Bench_World(config, pixels);
+	Bench_Edit(config, pixels);
+	Bench_Deferred(config, pixels);
+	free(pixels);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,346 @@
+//deferred.h
+//Two pass rendering: a march pass fills a G-buffer, a shading pass then works through the hits binned by body
+
+#ifndef TRACER_DEFERRED_H
+#define TRACER_DEFERRED_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "darr.h"
+#include "vec_math.h"
+#include "scene.h"
+#include "err_print.h"
+
+#define HIT_BODY_NONE SIZE_MAX
+#define GBUFFER_SHADE_CHUNK 64
+
+typedef struct {
+	Vec3 point;
+	Vec3 normal;
+	Vec3 direction;
+	Real depth;	//distance from the camera film along the ray
+	size_t body;	//index into scene.bodies, HIT_BODY_NONE when the ray escaped
+	size_t steps;
+} Hit_Record;
+
+DEF_DARR_TYPE(Hit_Record, Hit_Records);
+
+typedef struct {
+	size_t w, h;
+	Hit_Records hits;	//one per pixel, row major
+	Indices order;	//pixel indices sorted by body, misses and dark bodies are left out
+	Indices binStart;	//first position in order for every body, plus one past the end
+} GBuffer;
+
+typedef enum {
+	GBUFFER_VIEW_STEPS, GBUFFER_VIEW_DEPTH, GBUFFER_VIEW_NORMAL, GBUFFER_VIEW_BODY, GBUFFER_VIEWS
+} GBuffer_View;
+
+static inline void GBuffer_Destroy( GBuffer *gbuffer){
+
+	Hit_Records_destroy(&gbuffer->hits);
+	Indices_destroy(&gbuffer->order);
+	Indices_destroy(&gbuffer->binStart);
+	*gbuffer = (GBuffer){0};
+}
+
+static inline bool GBuffer_Create( GBuffer *gbuffer, const size_t w, const size_t h){
+
+	*gbuffer = (GBuffer){
+		.w = w,
+		.h = h,
+		.hits = Hit_Records_create(w * h),
+		.order = Indices_create(w * h),
+		.binStart = Indices_create(0)};
+	if(Hit_Records_valid(&gbuffer->hits) && Indices_valid(&gbuffer->order) && Indices_valid(&gbuffer->binStart)){
+		return true;
+	}else{
+		GBuffer_Destroy(gbuffer);
+		return false;
+	}
+}
+
+typedef struct {
+	Scene scene;
+	Camera camera;
+	GBuffer *gbuffer;
+	float* pixels;
+	atomic_size_t *next;	//next chunk of the binned order to shade
+	size_t mod;
+	size_t step;
+	Scene_Stats stats;
+} GBuffer_Pass_Parameters;
+
+extern void* Parallel_Scene_March_Func( void* par ){
+
+	GBuffer_Pass_Parameters params = *(GBuffer_Pass_Parameters*) par;
+	const Scene scene = params.scene;
+	const Camera camera = params.camera;
+	Hit_Record *const hits = params.gbuffer->hits.data;
+	for(size_t j = params.mod; j < camera.h; j+= params.step){
+		for(size_t i = 0; i < camera.w; i++){
+			Hit_Record hit = {.body = HIT_BODY_NONE};
+			Vec3 point;
+			Camera_PrimaryRay(camera, i, j, &point, &hit.direction);
+			const Body *body_ptr;
+			if(Scene_MarchCounted(scene, point, hit.direction, &hit.point, &body_ptr, &hit.steps)){
+				hit.body = body_ptr - scene.bodies.data;
+				hit.normal = Body_Normal(*body_ptr, hit.point);
+				hit.depth = Vec3Norm(Vec3Sub(hit.point, point));
+			}
+			hits[camera.w * j + i] = hit;
+		}
+	}
+	return NULL;
+}
+
+//Primary hits on smooth bodies whose direct light loops over every light in order can trace their shadow rays light by light
+static inline bool GBuffer_Batchable( const Scene scene, const Body body){
+	return BODY_SURFACE_SMOOTH == body.surface && !scene.lightGrid.cells
+		&& (!scene.lightSampling.samples || scene.lights.size <= scene.lightSampling.samples);
+}
+
+static inline void GBuffer_PutLighting( float* const pixels, const size_t pixel, const Real lighting){
+	pixels[3 * pixel + 0] = lighting;
+	pixels[3 * pixel + 1] = lighting;
+	pixels[3 * pixel + 2] = lighting;
+}
+
+//Same sums in the same order as Body_Lighting, but the shadow rays of the run go out one light at a time
+static inline void GBuffer_ShadeBatch(
+		const Scene scene,
+		const GBuffer *gbuffer,
+		const size_t begin,
+		const size_t end,
+		float* const pixels){
+
+	const Body body = Bodies_get(&scene.bodies, Hit_Records_at(&gbuffer->hits, Indices_get(&gbuffer->order, begin))->body);
+	Real direct[GBUFFER_SHADE_CHUNK];
+	for(size_t k = begin; k < end; k++)
+		direct[k - begin] = 0.0;
+	for(size_t l = 0; l < scene.lights.size; l++){
+		const Light light = Lights_get(&scene.lights, l);
+		for(size_t k = begin; k < end; k++){
+			const Hit_Record *hit = Hit_Records_at(&gbuffer->hits, Indices_get(&gbuffer->order, k));
+			if(Vec3Dot(hit->direction, hit->normal) >= 0) continue;
+			direct[k - begin] += Body_LightContribution(scene, body, light, hit->point, hit->normal, hit->direction);
+		}
+	}
+	for(size_t k = begin; k < end; k++){
+		const size_t pixel = Indices_get(&gbuffer->order, k);
+		const Hit_Record *hit = Hit_Records_at(&gbuffer->hits, pixel);
+		Real lighting = 0.0;
+		if(Vec3Dot(hit->direction, hit->normal) < 0){
+			Trace_State state = Trace_Seed(pixel);
+			lighting = scene.ambientLight;
+			if(scene.indirect.occlusionSamples)
+				lighting *= Scene_Occlusion(scene, hit->point, hit->normal);
+			lighting += direct[k - begin];
+			if(scene.indirect.indirectSamples)
+				lighting += Body_IndirectLighting(scene, body, hit->point, hit->normal, &state);
+		}
+		GBuffer_PutLighting(pixels, pixel, lighting);
+	}
+}
+
+//Threads take chunks of the binned order off a shared counter, a chunk is shaded in runs of one body
+extern void* Parallel_GBuffer_Shade_Func( void* par ){
+
+	GBuffer_Pass_Parameters params = *(GBuffer_Pass_Parameters*) par;
+	const Scene scene = params.scene;
+	const GBuffer *gbuffer = params.gbuffer;
+	float* const pixels = params.pixels;
+	const size_t n = Indices_get(&gbuffer->binStart, scene.bodies.size);
+	Scene_Stats stats = {0};
+	for(size_t chunk = atomic_fetch_add(params.next, GBUFFER_SHADE_CHUNK); chunk < n;
+			chunk = atomic_fetch_add(params.next, GBUFFER_SHADE_CHUNK)){
+		const size_t chunk_end = (chunk + GBUFFER_SHADE_CHUNK < n) ? chunk + GBUFFER_SHADE_CHUNK : n;
+		for(size_t begin = chunk, end; begin < chunk_end; begin = end){
+			const size_t body = Hit_Records_at(&gbuffer->hits, Indices_get(&gbuffer->order, begin))->body;
+			end = Indices_get(&gbuffer->binStart, body + 1);
+			if(end > chunk_end) end = chunk_end;
+			if(GBuffer_Batchable(scene, Bodies_get(&scene.bodies, body))){
+				GBuffer_ShadeBatch(scene, gbuffer, begin, end, pixels);
+				continue;
+			}
+			for(size_t k = begin; k < end; k++){
+				const size_t pixel = Indices_get(&gbuffer->order, k);
+				const Hit_Record hit = Hit_Records_get(&gbuffer->hits, pixel);
+				Trace_State state = Trace_Seed(pixel);
+				const Real lighting = Scene_ShadeHit(scene, hit.direction, Bodies_at(&scene.bodies, hit.body), hit.point, &state);
+				stats.secondaryRays += state.secondaryRays;
+				stats.droppedRays += state.droppedRays;
+				GBuffer_PutLighting(pixels, pixel, lighting);
+			}
+		}
+	}
+	((GBuffer_Pass_Parameters*) par)->stats = stats;
+	return NULL;
+}
+
+static inline Scene_Stats GBuffer_Pass_Run(
+		void* (*func)(void*),
+		const GBuffer_Pass_Parameters base_params,
+		const size_t numthreads){
+
+	GBuffer_Pass_Parameters params[numthreads];
+	pthread_t tids[numthreads];
+	for(size_t i = 0; i < numthreads; i++){
+		params[i] = base_params;
+		params[i].mod = i;
+		params[i].step = numthreads;
+		pthread_create(&tids[i], NULL, func, &params[i]);
+	}
+	Scene_Stats stats = {0};
+	for(size_t i = 0; i < numthreads; i++){
+		pthread_join(tids[i], NULL);
+		stats.secondaryRays += params[i].stats.secondaryRays;
+		stats.droppedRays += params[i].stats.droppedRays;
+	}
+	return stats;
+}
+
+//March pass, fills the G-buffer for the camera
+static inline bool Parallel_Scene_March(
+		const Scene scene,
+		const Camera camera,
+		GBuffer *const gbuffer,
+		const size_t numthreads){
+
+	if(gbuffer->w != camera.w || gbuffer->h != camera.h){
+		ERR_PRINT("G-buffer does not match the camera");
+		return false;
+	}
+	GBuffer_Pass_Run(Parallel_Scene_March_Func, (GBuffer_Pass_Parameters){
+			.scene = scene,
+			.camera = camera,
+			.gbuffer = gbuffer}, numthreads);
+	return true;
+}
+
+//Counting sort of the pixels by body index, misses and dark bodies shade to black and are left out
+static inline bool GBuffer_Shaded( const Scene scene, const size_t body){
+	return HIT_BODY_NONE != body && BODY_SURFACE_DARKNESS != Bodies_at(&scene.bodies, body)->surface;
+}
+
+static inline bool GBuffer_Bin( GBuffer *gbuffer, const Scene scene){
+
+	const size_t bins = scene.bodies.size;
+	if(!Indices_resize(&gbuffer->binStart, bins + 1))
+		return false;
+	size_t *start = gbuffer->binStart.data;
+	for(size_t b = 0; b <= bins; b++)
+		start[b] = 0;
+	const size_t n = gbuffer->hits.size;
+	for(size_t p = 0; p < n; p++){
+		const size_t body = Hit_Records_at(&gbuffer->hits, p)->body;
+		if(GBuffer_Shaded(scene, body))
+			start[body + 1]++;
+	}
+	for(size_t b = 0; b < bins; b++)
+		start[b + 1] += start[b];
+	size_t fill[bins];
+	for(size_t b = 0; b < bins; b++)
+		fill[b] = start[b];
+	for(size_t p = 0; p < n; p++){
+		const size_t body = Hit_Records_at(&gbuffer->hits, p)->body;
+		if(GBuffer_Shaded(scene, body))
+			Indices_put(&gbuffer->order, fill[body]++, p);
+	}
+	return true;
+}
+
+//Shading pass over a G-buffer filled by Parallel_Scene_March for the same scene
+static inline Scene_Stats Parallel_GBuffer_Shade(
+		const Scene scene,
+		const Camera camera,
+		GBuffer *const gbuffer,
+		float* const pixels,
+		const size_t numthreads){
+
+	if(!GBuffer_Bin(gbuffer, scene)){
+		ERR_PRINT("Error while binning G-buffer");
+		return (Scene_Stats){0};
+	}
+	for(size_t p = 0; p < gbuffer->hits.size; p++)
+		if(!GBuffer_Shaded(scene, Hit_Records_at(&gbuffer->hits, p)->body))
+			GBuffer_PutLighting(pixels, p, 0.0);
+	atomic_size_t next = 0;
+	return GBuffer_Pass_Run(Parallel_GBuffer_Shade_Func, (GBuffer_Pass_Parameters){
+			.scene = scene,
+			.camera = camera,
+			.gbuffer = gbuffer,
+			.pixels = pixels,
+			.next = &next}, numthreads);
+}
+
+//Same image as Parallel_Scene_Project
+static inline Scene_Stats Deferred_Scene_Project(
+		const Scene scene,
+		const Camera camera,
+		GBuffer *const gbuffer,
+		float* const pixels,
+		const size_t numthreads){
+
+	if(!Parallel_Scene_March(scene, camera, gbuffer, numthreads))
+		return (Scene_Stats){0};
+	return Parallel_GBuffer_Shade(scene, camera, gbuffer, pixels, numthreads);
+}
+
+//Stores a colour so that it comes out unchanged through the viewer's Reinhard mapping
+static inline void GBuffer_PutColor( float* const pixels, const size_t pixel, const Real rgb[static 3]){
+	for(size_t c = 0; c < 3; c++){
+		Real v = rgb[c];
+		if(v < 0.0) v = 0.0;
+		if(v > 0.99) v = 0.99;
+		pixels[3 * pixel + c] = v / (1.0 - v);
+	}
+}
+
+//Debug images of the G-buffer: step count heatmap, depth, normals or body index
+static inline void GBuffer_DebugView( const GBuffer *gbuffer, const GBuffer_View view, float* const pixels){
+
+	Real max_depth = 0.0;
+	if(GBUFFER_VIEW_DEPTH == view){
+		for(size_t p = 0; p < gbuffer->hits.size; p++){
+			const Hit_Record *hit = Hit_Records_at(&gbuffer->hits, p);
+			if(HIT_BODY_NONE == hit->body) continue;
+			if(hit->depth > max_depth) max_depth = hit->depth;
+		}
+	}
+	for(size_t p = 0; p < gbuffer->hits.size; p++){
+		const Hit_Record *hit = Hit_Records_at(&gbuffer->hits, p);
+		Real rgb[3] = {0.0, 0.0, 0.0};
+		switch(view){
+		case GBUFFER_VIEW_STEPS:
+		{
+			const Real t = (Real)hit->steps / Scene_Steps;
+			rgb[0] = (t < 0.5) ? 0.0 : 2.0 * t - 1.0;
+			rgb[1] = 1.0 - fabs(2.0 * t - 1.0);
+			rgb[2] = (t < 0.5) ? 1.0 - 2.0 * t : 0.0;
+			break;
+		}
+		case GBUFFER_VIEW_DEPTH:
+			if(HIT_BODY_NONE != hit->body && max_depth > 0.0)
+				rgb[0] = rgb[1] = rgb[2] = 1.0 - hit->depth / max_depth;
+			break;
+		case GBUFFER_VIEW_NORMAL:
+			if(HIT_BODY_NONE != hit->body)
+				for(size_t c = 0; c < 3; c++) rgb[c] = 0.5 + 0.5 * hit->normal.x[c];
+			break;
+		case GBUFFER_VIEW_BODY:
+			if(HIT_BODY_NONE != hit->body){
+				const Trace_State hash = Trace_Seed(hit->body);
+				for(size_t c = 0; c < 3; c++) rgb[c] = 0.2 + 0.8 * ((hash.rng >> (8 * c)) & 0xFF) / 255.0;
+			}
+			break;
+		default:
+			ERR_PRINT("Unknown GBuffer_View");
+			break;
+		}
+		GBuffer_PutColor(pixels, p, rgb);
+	}
+}
+
+#endif
@@ -1,15 +1,47 @@
 #include "scene.h"
+#include "scenes.h"
+#include "deferred.h"
 #include "vec_math.h"
 #include "video_sdl.h"
 #include <stdio.h>
 #include "err_print.h"
 #include <time.h>
+#include <string.h>
 
 double timediff(struct timespec t1, struct timespec t2){
 	return (t2.tv_sec - t1.tv_sec) + 1e-9 * (t2.tv_nsec - t1.tv_nsec);
 }
 
-int main( void ){
+//tracer [flat|occlusion|indirect_low|indirect_high] picks the lighting quality, flat by default,
+//tracer [steps|depth|normal|body] shows a G-buffer debug view instead of the lit image
+int main( int argc, char** argv ){
+	static const char* const views[GBUFFER_VIEWS] = {
+		[GBUFFER_VIEW_STEPS] = "steps",
+		[GBUFFER_VIEW_DEPTH] = "depth",
+		[GBUFFER_VIEW_NORMAL] = "normal",
+		[GBUFFER_VIEW_BODY] = "body"};
+	static const char* const qualities[SCENE_QUALITIES] = {
+		[SCENE_QUALITY_FLAT] = "flat",
+		[SCENE_QUALITY_OCCLUSION] = "occlusion",
+		[SCENE_QUALITY_INDIRECT_LOW] = "indirect_low",
+		[SCENE_QUALITY_INDIRECT_HIGH] = "indirect_high"};
+	GBuffer_View view = GBUFFER_VIEWS;
+	Scene_Quality quality = SCENE_QUALITY_FLAT;
+	bool known = argc <= 1;
+	for(size_t v = 0; argc > 1 && v < GBUFFER_VIEWS; v++)
+		if(!strcmp(argv[1], views[v])){
+			view = v;
+			known = true;
+		}
+	for(size_t q = 0; argc > 1 && q < SCENE_QUALITIES; q++)
+		if(!strcmp(argv[1], qualities[q])){
+			quality = q;
+			known = true;
+		}
+	if(!known){
+		fprintf(stderr, "usage: %s [flat|occlusion|indirect_low|indirect_high|steps|depth|normal|body]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
 	size_t w = 1280, h = 800;
 	Video video;
 	if(!Video_Create(&video, w, h, "Hui")){ 
@@ -18,63 +50,13 @@ int main( void ){
 		return EXIT_FAILURE;
 	}
 	Scene scene;
-	Scene_Create(&scene, 0.1, 100.0);
-	Camera camera = Camera_Create( w, h, 0.5);
-	camera.focus = 0.5;
-	camera.rotation = Mat3f_Unity;
-	camera.position = (Vec3f){0};
-	/*Scene_AddLight(
-			&scene, 
-			(Light){
-			.type = LIGHT_TYPE_AFFINE,
-			.affine.direction = Vec3fNormalized((Vec3f){{0.3, 1.0, 0.3}}),
-			.affine.intensity = 1.0},
-			(Body){
-			.surface = BODY_SURFACE_DARKNESS,
-			.shape.type = SHAPE_TYPE_HALFSPACE,
-			.shape.halfspace.normal = {{0.0, -1.0, 0.0}},
-			.shape.halfspace.c = -10.0});*/
-	Scene_AddLight(
-			&scene, 
-			(Light){
-			.type = LIGHT_TYPE_POINT,
-			.point.center = {{5.0, 15.0, -5.0 }},
-			.point.intensity = 400.0},
-			(Body){
-			.surface = BODY_SURFACE_DARKNESS,
-			.shape.type = SHAPE_TYPE_HALFSPACE,
-			.shape.halfspace.normal = {{0.0, -1.0, 0.0}},
-			.shape.halfspace.c = -10.0});
-	
-	
-	Reflection_Parameters smooth_ha = {.phongCoeff = 1.0, .lambertCoeff = 0.9, .phongExponent = 4.0};	
-	Reflection_Parameters smooth_la = {.phongCoeff = 0.7, .lambertCoeff = 0.2, .phongExponent = 4.0};
-	Scene_AddBody(
-			&scene,
-			(Body){
-			.surface = BODY_SURFACE_SMOOTH,
-			.shape.type = SHAPE_TYPE_HALFSPACE,
-			.shape.halfspace.normal = {{0.0, 1.0, 0.0}},
-			.shape.halfspace.c = - 3.0,
-			.reflectionParameters = smooth_la});
-	Scene_AddBody(
-			&scene,
-			(Body){
-			.surface = BODY_SURFACE_SMOOTH,
-			.shape.type = SHAPE_TYPE_BALL,
-			.reflectionParameters = smooth_ha,
-			.shape.ball.center = {{0.0, 0.0, 8.5}},
-			.shape.ball.radius = 0.2});
-
-	Scene_AddBody(
-			&scene,
-			(Body){
-			.surface = BODY_SURFACE_SMOOTH,
-			.shape.type = SHAPE_TYPE_BALL,
-			.reflectionParameters = smooth_ha,
-			.shape.ball.center = {{0.0, -1.0, 9.0}},
-			.shape.ball.radius = 0.5});
-	//Vec3f p;
+	if(!Scenes_Demo(&scene)){
+		Video_Destroy(&video);
+		return EXIT_FAILURE;
+	}
+	Scene_SetQuality(&scene, quality);
+	Camera camera = Scenes_DemoCamera( w, h);
+	//Vec3 p;
 	//scanf("%f%f%f", p.x, p.x+1, p.x+2);
 	//Body *body;
 	//printf("dist: %f\n", Scene_Distance(scene, p, &body));
@@ -83,7 +65,15 @@ int main( void ){
 	clock_gettime(CLOCK_MONOTONIC, &pt1);
 	//Scene_Project(scene,camera, video.realmap);
 	//for(size_t i = 0; i < 10; i++ )
-	Parallel_Scene_Project(scene,camera, video.realmap, 16);
+	GBuffer gbuffer = {0};
+	if(GBUFFER_VIEWS == view){
+		Parallel_Scene_Project(scene,camera, video.realmap, 16);
+	}else if(GBuffer_Create(&gbuffer, w, h)){
+		Parallel_Scene_March(scene, camera, &gbuffer, 16);
+		GBuffer_DebugView(&gbuffer, view, video.realmap);
+	}else{
+		ERR_PRINT("Error while creating G-buffer");
+	}
 	clock_t t2 = clock();
 	struct timespec pt2;
        	clock_gettime(CLOCK_MONOTONIC, &pt2);
@@ -92,6 +82,7 @@ int main( void ){
 
 	Video_RealmapDraw(video);
 	WaitExit();
+	GBuffer_Destroy(&gbuffer);
 	Scene_Destroy(&scene);
 	Video_Destroy(&video);
 	return EXIT_SUCCESS;
@@ -0,0 +1,479 @@
+//regress.c
+//Renders the canonical scenes headlessly and compares them with stored reference images
+
+#include "scene.h"
+#include "scenes.h"
+#include "scene_edit.h"
+#include "deferred.h"
+#include "vec_math.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "err_print.h"
+
+#define REGRESS_W 96
+#define REGRESS_H 60
+#define REGRESS_THREADS 4
+#define REGRESS_WINDOW 8
+
+//Per pixel check on tone mapped values, a few outliers are tolerated.
+//Tight enough that every case fails once its feature is switched off.
+const double Regress_Pixel_Tolerance = 0.002;
+const double Regress_Outlier_Fraction = 0.0005;
+//Mean structural similarity of the tone mapped luminance
+const double Regress_Min_Ssim = 0.999;
+//Untouched tiles keep values marched before the edit, the hit points there agree up to round-off
+const double Regress_Edit_Epsilon = 1e-5;
+
+typedef struct {
+	const char* name;
+	bool (*build)(Scene *scene);
+	void (*disable)(Scene *scene);	//switches the feature under test off, NULL for the baseline
+} Regress_Case;
+
+static bool Regress_Flat( Scene *scene){
+	return Scenes_Demo(scene);
+}
+
+//Bright ambient light and a long occlusion reach, occlusion only darkens the ambient term
+static bool Regress_Occlusion( Scene *scene){
+	if(!Scenes_Demo(scene)) return false;
+	Scene_SetQuality(scene, SCENE_QUALITY_OCCLUSION);
+	scene->ambientLight = 1.0;
+	scene->indirect.occlusionStep = 0.4;
+	return true;
+}
+
+static void Regress_OcclusionOff( Scene *scene){
+	scene->indirect.occlusionSamples = 0;
+}
+
+static bool Regress_Indirect( Scene *scene){
+	if(!Scenes_Demo(scene)) return false;
+	Scene_SetQuality(scene, SCENE_QUALITY_INDIRECT_LOW);
+	return true;
+}
+
+static void Regress_IndirectOff( Scene *scene){
+	scene->indirect.indirectSamples = 0;
+}
+
+static bool Regress_Reflective( Scene *scene){
+	return Scenes_Reflective(scene);
+}
+
+static void Regress_ReflectiveOff( Scene *scene){
+	for(size_t i = 0; i < scene->bodies.size; i++){
+		Body *body = Bodies_at(&scene->bodies, i);
+		if(BODY_SURFACE_MIRROR == body->surface || BODY_SURFACE_GLOSSY == body->surface || BODY_SURFACE_GLASS == body->surface)
+			body->surface = BODY_SURFACE_SMOOTH;
+	}
+}
+
+static bool Regress_ManyLights( Scene *scene){
+	if(!Scenes_ManyLights(scene, 64)) return false;
+	scene->lightSampling.cutoff = 0.02;
+	scene->lightSampling.samples = 8;
+	return Scene_BuildLightGrid(scene, 16);
+}
+
+static void Regress_ManyLightsOff( Scene *scene){
+	Light_GridDestroy(&scene->lightGrid);
+	scene->lightSampling = (Light_Sampling){0};
+}
+
+static const Regress_Case Regress_Cases[] = {
+	{"flat", Regress_Flat, NULL},
+	{"occlusion", Regress_Occlusion, Regress_OcclusionOff},
+	{"indirect", Regress_Indirect, Regress_IndirectOff},
+	{"reflective", Regress_Reflective, Regress_ReflectiveOff},
+	{"many_lights", Regress_ManyLights, Regress_ManyLightsOff}};
+
+//Same Reinhard mapping the viewer uses
+static inline double Regress_Tonemap( const float value){
+	return value / (1.0 + value);
+}
+
+//Portable float map, rows stored bottom to top
+static bool Regress_WritePfm( const char* path, const float* pixels, const size_t w, const size_t h){
+	FILE* f = fopen(path, "wb");
+	if(!f) return false;
+	fprintf(f, "PF\n%zu %zu\n-1.0\n", w, h);
+	bool ok = true;
+	for(size_t j = h; ok && j-- > 0;)
+		ok = (fwrite(pixels + 3 * w * j, sizeof *pixels, 3 * w, f) == 3 * w);
+	return (0 == fclose(f)) && ok;
+}
+
+static bool Regress_ReadPfm( const char* path, float* pixels, const size_t w, const size_t h){
+	FILE* f = fopen(path, "rb");
+	if(!f) return false;
+	size_t fw, fh;
+	double scale;
+	bool ok = (3 == fscanf(f, "PF %zu %zu %lf", &fw, &fh, &scale)) && (fw == w) && (fh == h) && (scale < 0.0);
+	ok = ok && ('\n' == fgetc(f));
+	for(size_t j = h; ok && j-- > 0;)
+		ok = (fread(pixels + 3 * w * j, sizeof *pixels, 3 * w, f) == 3 * w);
+	fclose(f);
+	return ok;
+}
+
+//Absolute tone mapped difference, amplified
+static bool Regress_WriteDiff( const char* path, const float* a, const float* b, const size_t w, const size_t h){
+	FILE* f = fopen(path, "wb");
+	if(!f) return false;
+	fprintf(f, "P6\n%zu %zu\n255\n", w, h);
+	for(size_t i = 0; i < 3 * w * h; i++){
+		double d = 8.0 * fabs(Regress_Tonemap(a[i]) - Regress_Tonemap(b[i]));
+		fputc((d >= 1.0) ? 255 : (int)(d * 255), f);
+	}
+	return 0 == fclose(f);
+}
+
+//Mean SSIM over non overlapping windows of the luminance
+static double Regress_Ssim( const float* a, const float* b, const size_t w, const size_t h){
+	const double c1 = 0.01 * 0.01, c2 = 0.03 * 0.03;
+	double total = 0.0;
+	size_t windows = 0;
+	for(size_t wj = 0; wj + REGRESS_WINDOW <= h; wj += REGRESS_WINDOW){
+		for(size_t wi = 0; wi + REGRESS_WINDOW <= w; wi += REGRESS_WINDOW){
+			double ma = 0.0, mb = 0.0, vaa = 0.0, vbb = 0.0, vab = 0.0;
+			for(size_t j = wj; j < wj + REGRESS_WINDOW; j++){
+				for(size_t i = wi; i < wi + REGRESS_WINDOW; i++){
+					double la = 0.0, lb = 0.0;
+					for(size_t c = 0; c < 3; c++){
+						la += Regress_Tonemap(a[3 * (w * j + i) + c]) / 3;
+						lb += Regress_Tonemap(b[3 * (w * j + i) + c]) / 3;
+					}
+					ma += la;
+					mb += lb;
+					vaa += la * la;
+					vbb += lb * lb;
+					vab += la * lb;
+				}
+			}
+			const double n = REGRESS_WINDOW * REGRESS_WINDOW;
+			ma /= n;
+			mb /= n;
+			vaa = vaa / n - ma * ma;
+			vbb = vbb / n - mb * mb;
+			vab = vab / n - ma * mb;
+			total += ((2 * ma * mb + c1) * (2 * vab + c2)) / ((ma * ma + mb * mb + c1) * (vaa + vbb + c2));
+			windows++;
+		}
+	}
+	return windows ? total / windows : 1.0;
+}
+
+typedef struct {
+	size_t outliers;
+	double worst;
+	double ssim;
+} Regress_Metric;
+
+static bool Regress_Measure( const float* pixels, const float* reference, Regress_Metric *const metric){
+	const size_t n = 3 * REGRESS_W * REGRESS_H;
+	*metric = (Regress_Metric){0};
+	for(size_t i = 0; i < n; i++){
+		const double d = fabs(Regress_Tonemap(pixels[i]) - Regress_Tonemap(reference[i]));
+		if(!(d <= Regress_Pixel_Tolerance)) metric->outliers++;
+		if(d > metric->worst) metric->worst = d;
+	}
+	metric->ssim = Regress_Ssim(pixels, reference, REGRESS_W, REGRESS_H);
+	return (metric->outliers <= Regress_Outlier_Fraction * n) && (metric->ssim >= Regress_Min_Ssim);
+}
+
+static bool Regress_Compare( const char* name, const char* outdir, const float* pixels, const float* reference){
+	const size_t n = 3 * REGRESS_W * REGRESS_H;
+	char path[4096];
+	Regress_Metric metric;
+	const bool ok = Regress_Measure(pixels, reference, &metric);
+	printf("%-22s %s  outliers %zu/%zu  worst %.6f  ssim %.6f\n", name, ok ? "ok  " : "FAIL", metric.outliers, n, metric.worst, metric.ssim);
+	if(!ok){
+		snprintf(path, sizeof path, "%s/%s_diff.ppm", outdir, name);
+		if(!Regress_WriteDiff(path, pixels, reference, REGRESS_W, REGRESS_H))
+			ERR_PRINT("Error while writing diff image");
+		snprintf(path, sizeof path, "%s/%s_actual.pfm", outdir, name);
+		if(!Regress_WritePfm(path, pixels, REGRESS_W, REGRESS_H))
+			ERR_PRINT("Error while writing actual image");
+	}
+	return ok;
+}
+
+//Two paths over the same scene and seeds, every value within epsilon of the other, bit exact for zero
+static bool Regress_Match( const char* name, const char* outdir, const float* pixels, const float* reference, const double epsilon){
+	const size_t n = 3 * REGRESS_W * REGRESS_H;
+	char path[4096];
+	size_t differing = 0;
+	double worst = 0.0;
+	for(size_t i = 0; i < n; i++){
+		const double d = fabs((double)pixels[i] - reference[i]);
+		if(!(d <= epsilon)) differing++;
+		if(d > worst) worst = d;
+	}
+	const bool ok = !differing;
+	printf("%-22s %s  differing %zu/%zu  worst %.3g\n", name, ok ? "ok  " : "FAIL", differing, n, worst);
+	if(!ok){
+		snprintf(path, sizeof path, "%s/%s_diff.ppm", outdir, name);
+		if(!Regress_WriteDiff(path, pixels, reference, REGRESS_W, REGRESS_H))
+			ERR_PRINT("Error while writing diff image");
+	}
+	return ok;
+}
+
+//The feature under test must be visible to the comparison, the case renders again with it switched off
+static bool Regress_Sensitive( const Regress_Case test, float* pixels, const float* reference){
+	Scene scene;
+	if(!test.build(&scene)){
+		printf("%-22s FAIL scene\n", test.name);
+		return false;
+	}
+	test.disable(&scene);
+	Parallel_Scene_Project(scene, Scenes_DemoCamera(REGRESS_W, REGRESS_H), pixels, REGRESS_THREADS);
+	Scene_Destroy(&scene);
+	Regress_Metric metric;
+	const bool missed = Regress_Measure(pixels, reference, &metric);
+	printf("%-22s %s  feature off: outliers %zu  worst %.6f  ssim %.6f\n", test.name, missed ? "FAIL" : "ok  ", metric.outliers, metric.worst, metric.ssim);
+	return !missed;
+}
+
+static bool Regress_Run( const Regress_Case test, const char* refdir, const char* outdir, const bool update, float* pixels, float* reference){
+	char path[4096];
+	Scene scene;
+	if(!test.build(&scene)){
+		printf("%-22s FAIL scene\n", test.name);
+		return false;
+	}
+	Parallel_Scene_Project(scene, Scenes_DemoCamera(REGRESS_W, REGRESS_H), pixels, REGRESS_THREADS);
+	Scene_Destroy(&scene);
+
+	snprintf(path, sizeof path, "%s/%s.pfm", refdir, test.name);
+	if(update){
+		const bool ok = Regress_WritePfm(path, pixels, REGRESS_W, REGRESS_H);
+		printf("%-22s %s %s\n", test.name, ok ? "UPDATED" : "FAIL writing", path);
+		return ok;
+	}
+	if(!Regress_ReadPfm(path, reference, REGRESS_W, REGRESS_H)){
+		printf("%-22s FAIL reading %s\n", test.name, path);
+		return false;
+	}
+	if(!Regress_Compare(test.name, outdir, pixels, reference))
+		return false;
+	return !test.disable || Regress_Sensitive(test, pixels, reference);
+}
+
+//Renders the edits since the last step and compares with a full render of the edited scene
+static bool Regress_EditStep( Scene_Editor *editor, const char* name, const char* step, const char* outdir, float* pixels, float* reference, size_t *const tiles){
+	const Camera camera = Scenes_DemoCamera(REGRESS_W, REGRESS_H);
+	*tiles += Scene_EditorRender(editor, camera, pixels, REGRESS_THREADS);
+	Parallel_Scene_Project(*editor->scene, camera, reference, REGRESS_THREADS);
+	char label[64];
+	snprintf(label, sizeof label, "%s_%s", name, step);
+	size_t differing = 0;
+	for(size_t i = 0; i < 3 * REGRESS_W * REGRESS_H; i++)
+		if(!(fabs((double)pixels[i] - reference[i]) <= Regress_Edit_Epsilon)) differing++;
+	return !differing || Regress_Match(label, outdir, pixels, reference, Regress_Edit_Epsilon);
+}
+
+//Removed handles must stay dead, also once newer elements take over their slots
+static bool Regress_EditHandlesDead( Scene_Editor *editor, const Scene_Handle body, const Scene_Handle light){
+	const Scene *scene = editor->scene;
+	for(size_t i = 0; i < scene->lights.size; i++)
+		if(Lights_at(&scene->lights, i)->source >= scene->bodies.size)
+			return false;
+	if(SCENE_HANDLE_NONE != body && (SIZE_MAX != Scene_EditorBodyIndex(editor, body)
+				|| Scene_EditorUpdateBody(editor, body, Bodies_get(&scene->bodies, 0))
+				|| Scene_EditorRemoveBody(editor, body)))
+		return false;
+	if(SCENE_HANDLE_NONE != light && (SIZE_MAX != Scene_EditorLightIndex(editor, light)
+				|| Scene_EditorUpdateLight(editor, light, Lights_get(&scene->lights, 0))
+				|| Scene_EditorRemoveLight(editor, light)))
+		return false;
+	return true;
+}
+
+//Incremental rendering after edits has to match a full render of the edited scene up to Regress_Edit_Epsilon after every step.
+//Covers removing the newest body and light, whose slots are not swapped, and bounded lights with dirty regions.
+//Total of all values, for checks that an edit brightens the image
+static double Regress_Sum( const float* pixels){
+	double sum = 0.0;
+	for(size_t i = 0; i < 3 * REGRESS_W * REGRESS_H; i++)
+		sum += pixels[i];
+	return sum;
+}
+
+static bool Regress_EditCase( const Regress_Case test, const char* outdir, float* pixels, float* reference){
+	char name[64];
+	snprintf(name, sizeof name, "edit_%s", test.name);
+	Scene scene;
+	Scene_Editor editor;
+	if(!test.build(&scene)){
+		printf("%-22s FAIL scene\n", name);
+		return false;
+	}
+	scene.lightSampling.cutoff = 0.02;
+	if(!Scene_EditorCreate(&editor, &scene)){
+		printf("%-22s FAIL editor\n", name);
+		Scene_Destroy(&scene);
+		return false;
+	}
+	size_t tiles = 0, steps = 0;
+	bool ok = Regress_EditStep(&editor, name, "create", outdir, pixels, reference, &tiles);
+	steps++;
+
+	const Scene_Handle small = 2;
+	Body body = Bodies_get(&scene.bodies, Scene_EditorBodyIndex(&editor, small));
+	body.shape.ball.center.x[0] += 0.3;
+	ok = ok && Scene_EditorUpdateBody(&editor, small, body);
+	body.shape.ball.center = (Vec3){{-1.0, -0.7, 8.0}};
+	const Scene_Handle newest = Scene_EditorAddBody(&editor, body);
+	ok = ok && (SCENE_HANDLE_NONE != newest);
+	ok = ok && Regress_EditStep(&editor, name, "add", outdir, pixels, reference, &tiles);
+	steps++;
+
+	ok = ok && Scene_EditorRemoveBody(&editor, newest);
+	ok = ok && Regress_EditHandlesDead(&editor, newest, SCENE_HANDLE_NONE);
+	body.shape.ball.center = (Vec3){{0.8, -0.8, 8.2}};
+	const Scene_Handle replacement = Scene_EditorAddBody(&editor, body);
+	ok = ok && (SCENE_HANDLE_NONE != replacement) && Regress_EditHandlesDead(&editor, newest, SCENE_HANDLE_NONE);
+	ok = ok && Regress_EditStep(&editor, name, "remove_newest", outdir, pixels, reference, &tiles);
+	steps++;
+
+	ok = ok && Scene_EditorRemoveBody(&editor, small);
+	ok = ok && Regress_EditHandlesDead(&editor, small, SCENE_HANDLE_NONE);
+	ok = ok && Regress_EditStep(&editor, name, "remove_swapped", outdir, pixels, reference, &tiles);
+	steps++;
+
+	//Primary rays pass about a unit above this ball on their way to the floor
+	body.shape.ball.center = (Vec3){{-1.0, -2.05, 6.0}};
+	ok = ok && (SCENE_HANDLE_NONE != Scene_EditorAddBody(&editor, body));
+	ok = ok && Regress_EditStep(&editor, name, "add_grazed", outdir, pixels, reference, &tiles);
+	steps++;
+	const double unlit = Regress_Sum(pixels);
+
+	const Body lamp = {
+		.surface = BODY_SURFACE_DARKNESS,
+		.shape.type = SHAPE_TYPE_BALL,
+		.shape.ball.center = {{1.5, -0.5, 8.0}},
+		.shape.ball.radius = 0.05};
+	Light light = {
+		.type = LIGHT_TYPE_POINT,
+		.point.center = lamp.shape.ball.center,
+		.point.intensity = 0.5};
+	const Scene_Handle added_light = Scene_EditorAddLight(&editor, light, lamp);
+	ok = ok && (SCENE_HANDLE_NONE != added_light);
+	ok = ok && Regress_EditStep(&editor, name, "add_light", outdir, pixels, reference, &tiles);
+	steps++;
+	const double lit = Regress_Sum(pixels);
+
+	light.point.center = (Vec3){{-1.2, -0.4, 8.5}};
+	ok = ok && Scene_EditorUpdateLight(&editor, added_light, light);
+	ok = ok && Regress_EditStep(&editor, name, "update_light", outdir, pixels, reference, &tiles);
+	steps++;
+	//The moved light has to keep lighting the scene, its source body goes with it
+	const double moved = Regress_Sum(pixels);
+	if(!(lit > unlit && moved - unlit > 0.5 * (lit - unlit))){
+		printf("%-22s FAIL light adds %.2f, %.2f once moved\n", name, lit - unlit, moved - unlit);
+		ok = false;
+	}
+
+	ok = ok && Scene_EditorRemoveLight(&editor, added_light);
+	ok = ok && Regress_EditHandlesDead(&editor, SCENE_HANDLE_NONE, added_light);
+	const Scene_Handle other_light = Scene_EditorAddLight(&editor, light, lamp);
+	ok = ok && (SCENE_HANDLE_NONE != other_light) && Regress_EditHandlesDead(&editor, SCENE_HANDLE_NONE, added_light);
+	ok = ok && Scene_EditorRemoveLight(&editor, other_light);
+	ok = ok && Regress_EditStep(&editor, name, "remove_light", outdir, pixels, reference, &tiles);
+	steps++;
+
+	const Camera camera = Scenes_DemoCamera(REGRESS_W, REGRESS_H);
+	const size_t total = Camera_TilesX(camera, SCENE_EDIT_TILE) * Camera_TilesY(camera, SCENE_EDIT_TILE);
+	Scene_EditorDestroy(&editor);
+	Scene_Destroy(&scene);
+	printf("%-22s %s  tiles %zu of %zu over %zu renders\n", name, ok ? "ok  " : "FAIL", tiles, total * steps, steps);
+	return ok;
+}
+
+//Default occlusion reach, the long one of the occlusion case leaves no tile clean
+static bool Regress_EditOcclusion( Scene *scene){
+	if(!Scenes_Demo(scene)) return false;
+	Scene_SetQuality(scene, SCENE_QUALITY_OCCLUSION);
+	scene->ambientLight = 1.0;
+	return true;
+}
+
+static bool Regress_Edit( const char* outdir, float* pixels, float* reference){
+	const Regress_Case cases[] = {
+		{"flat", Regress_Flat, NULL},
+		{"occlusion", Regress_EditOcclusion, NULL}};
+	bool ok = true;
+	for(size_t i = 0; i < sizeof cases / sizeof *cases; i++)
+		ok = Regress_EditCase(cases[i], outdir, pixels, reference) && ok;
+	return ok;
+}
+
+//The two pass path has to reproduce the forward image of every canonical scene bit for bit
+static bool Regress_Deferred( const char* outdir, float* pixels, float* reference){
+	const Camera camera = Scenes_DemoCamera(REGRESS_W, REGRESS_H);
+	GBuffer gbuffer;
+	if(!GBuffer_Create(&gbuffer, REGRESS_W, REGRESS_H)){
+		printf("%-22s FAIL G-buffer\n", "deferred");
+		return false;
+	}
+	bool ok = true;
+	for(size_t i = 0; i < sizeof Regress_Cases / sizeof *Regress_Cases; i++){
+		char name[64];
+		snprintf(name, sizeof name, "deferred_%s", Regress_Cases[i].name);
+		Scene scene;
+		if(!Regress_Cases[i].build(&scene)){
+			printf("%-22s FAIL scene\n", name);
+			ok = false;
+			continue;
+		}
+		const Scene_Stats forward = Parallel_Scene_Project(scene, camera, reference, REGRESS_THREADS);
+		const Scene_Stats deferred = Deferred_Scene_Project(scene, camera, &gbuffer, pixels, REGRESS_THREADS);
+		Scene_Destroy(&scene);
+		if(forward.secondaryRays != deferred.secondaryRays){
+			printf("%-22s FAIL secondary rays %zu, forward %zu\n", name, deferred.secondaryRays, forward.secondaryRays);
+			ok = false;
+		}
+		ok = Regress_Match(name, outdir, pixels, reference, 0.0) && ok;
+	}
+	GBuffer_Destroy(&gbuffer);
+	return ok;
+}
+
+int main( int argc, char** argv){
+	bool update = false;
+	int arg = 1;
+	if(arg < argc && !strcmp(argv[arg], "--update")){
+		update = true;
+		arg++;
+	}
+	if(arg >= argc){
+		fprintf(stderr, "usage: %s [--update] reference_dir [output_dir]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char* refdir = argv[arg];
+	const char* outdir = (arg + 1 < argc) ? argv[arg + 1] : ".";
+
+	const size_t n = 3 * REGRESS_W * REGRESS_H;
+	float* pixels = malloc(n * sizeof *pixels);
+	float* reference = malloc(n * sizeof *reference);
+	if(!pixels || !reference){
+		ERR_PRINT("Error while allocating pixels");
+		free(pixels);
+		free(reference);
+		return EXIT_FAILURE;
+	}
+	size_t failed = 0;
+	for(size_t i = 0; i < sizeof Regress_Cases / sizeof *Regress_Cases; i++)
+		if(!Regress_Run(Regress_Cases[i], refdir, outdir, update, pixels, reference))
+			failed++;
+	if(!update && !Regress_Edit(outdir, pixels, reference))
+		failed++;
+	if(!update && !Regress_Deferred(outdir, pixels, reference))
+		failed++;
+	free(pixels);
+	free(reference);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
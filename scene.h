@@ -5,7 +5,7 @@
 #define TRACER_SCENE_H
 
 #include <stdio.h>
-#include <math.h>
+#include <tgmath.h>
 #include "darr.h"
 #include "vec_math.h"
 #include "err_print.h"
@@ -18,19 +18,19 @@ typedef enum {
 } Shape_Type;
 
 typedef enum {
-	BODY_SURFACE_DARKNESS, BODY_SURFACE_SMOOTH, BODY_SURFACES
+	BODY_SURFACE_DARKNESS, BODY_SURFACE_SMOOTH, BODY_SURFACE_MIRROR, BODY_SURFACE_GLOSSY, BODY_SURFACE_GLASS, BODY_SURFACES
 } Body_Surface;
 
 typedef struct Shape Shape;
 
 typedef struct {
-	Vec3f normal;
-	float c;
+	Vec3 normal;
+	Real c;
 } Shape_Halfspace;
 
 typedef struct {
-	Vec3f center;
-	float radius;
+	Vec3 center;
+	Real radius;
 } Shape_Ball;
 
 struct Shape {
@@ -42,9 +42,12 @@ struct Shape {
 };
 
 typedef struct {
-	float phongCoeff;
-	float phongExponent;
-	float lambertCoeff;
+	Real phongCoeff;
+	Real phongExponent;
+	Real lambertCoeff;
+	Real reflectance;	//mirror and glossy: share of the reflected ray, the rest is shaded locally
+	Real glossiness;	//glossy: spread of the reflected direction
+	Real refractiveIndex;	//glass
 } Reflection_Parameters;
 
 typedef struct {
@@ -58,13 +61,13 @@ typedef enum {
 } Light_Type;
 
 typedef struct {
-	Vec3f direction;
-	float intensity;
+	Vec3 direction;
+	Real intensity;
 } Light_Affine;
 
 typedef struct {
-	Vec3f center;
-	float intensity;
+	Vec3 center;
+	Real intensity;
 } Light_Point;
 
 typedef struct {
@@ -78,96 +81,229 @@ typedef struct {
 
 DEF_DARR_TYPE(Body, Bodies);
 DEF_DARR_TYPE(Light, Lights);
+DEF_DARR_TYPE(size_t, Indices);
 
+//Uniform grid over the bounding cube, each cell lists the point lights whose influence reaches it
 typedef struct {
-	float ambientLight;
-	float bound;
+	size_t resolution;
+	Real cellSize;
+	Real cutoff;	//scene.lightSampling.cutoff the cells were filled for
+	Real bound;	//scene.bound the cells were laid out for
+	Indices unbounded;	//affine lights and point lights without a finite influence radius
+	Indices *cells;
+} Light_Grid;
+
+//Many light shading, everything is off when zeroed
+typedef struct {
+	Real cutoff;	//point lights are ignored where intensity/(dist*dist) falls below it
+	size_t samples;	//lights sampled per shaded point, all of them when zero
+} Light_Sampling;
+
+//Cheap global illumination, everything is off when zeroed
+typedef struct {
+	size_t occlusionSamples;
+	Real occlusionStep;
+	Real occlusionStrength;
+	size_t indirectSamples;	//bounces per pixel, shared by all hits of its ray tree
+} Indirect_Parameters;
+
+//Bounds on secondary rays spawned by mirror, glossy and glass surfaces
+typedef struct {
+	size_t maxDepth;
+	size_t rayBudget;	//secondary rays per pixel
+	Real minThroughput;	//rays that would contribute less are dropped
+} Trace_Parameters;
+
+typedef enum {
+	SCENE_QUALITY_FLAT, SCENE_QUALITY_OCCLUSION, SCENE_QUALITY_INDIRECT_LOW, SCENE_QUALITY_INDIRECT_HIGH, SCENE_QUALITIES
+} Scene_Quality;
+
+typedef struct {
+	Real ambientLight;
+	Real bound;
+	Vec3d origin;	//world position of the local zero, see Scene_Rebase
+	Indirect_Parameters indirect;
+	Trace_Parameters trace;
+	Light_Sampling lightSampling;
+	Light_Grid lightGrid;
 	Bodies bodies;
 	Lights lights;
 } Scene;
 
+//Per pixel tracing state, seeded from the pixel index so images are reproducible for any thread count
+typedef struct {
+	uint32_t rng;
+	size_t secondaryRays;
+	size_t droppedRays;
+	size_t indirectSamples;	//bounces spent so far
+} Trace_State;
+
+//Per frame counters
+typedef struct {
+	size_t secondaryRays;
+	size_t droppedRays;
+} Scene_Stats;
+
+typedef struct {
+	Vec3 point;
+	Vec3 direction;
+	Real throughput;
+	size_t depth;
+	const Body *inside;	//non NULL while travelling through a glass body
+} Trace_Ray;
+
 
 const size_t Scene_Steps = 200;
-const float Scene_Eps_in = 0.001;
-const float Scene_Outfactor = 0.5;
-const float Scene_March_Coeff = 0.99;
-const float Scene_March_Jump = 0.01;
+const Real Scene_Eps_in = 0.001;
+const Real Scene_Eps_Relative = 16 * REAL_EPSILON;
+const Real Scene_Outfactor = 0.5;
+const Real Scene_March_Coeff = 0.99;
+const Real Scene_March_Jump = 0.01;
+#define SCENE_TRACE_STACK 16
 
 typedef struct {
 	size_t w,h;
-	float dx, dy;
-	Mat3f rotation;
-	Vec3f position;
-	float focus;
+	Real dx, dy;
+	Mat3 rotation;
+	Vec3 position;
+	Real focus;
 } Camera;
 
-static inline float Shape_Distance( const Shape shape, const Vec3f point){
+static inline Trace_State Trace_Seed(const size_t pixel){
+	uint32_t x = (uint32_t)pixel * 0x9E3779B9u + 0x7F4A7C15u;
+	x ^= x >> 16;
+	x *= 0x85EBCA6Bu;
+	x ^= x >> 13;
+	return (Trace_State){.rng = x ? x : 1};
+}
+
+//xorshift32, returns a number in [0, 1)
+static inline Real Trace_Random(Trace_State *const state){
+	uint32_t x = state->rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	state->rng = x;
+	return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline Real Shape_Distance( const Shape shape, const Vec3 point){
 	switch(shape.type){
 	case SHAPE_TYPE_HALFSPACE: 
-		return Vec3fDot( shape.halfspace.normal, point) - shape.halfspace.c;
+		return Vec3Dot( shape.halfspace.normal, point) - shape.halfspace.c;
 	case SHAPE_TYPE_BALL:
-		return Vec3fNorm( Vec3fSub(point, shape.ball.center)) - shape.ball.radius;
+		return Vec3Norm( Vec3Sub(point, shape.ball.center)) - shape.ball.radius;
 	default: 
 		ERR_PRINT("Unknown Shape_Type");
 		return 0.0;
 	}
 }
 
-static inline float Body_Distance( const Body body, const Vec3f point){
+//Hit threshold at a given distance from the origin, grows once the fixed one drops below the scalar's resolution
+static inline Real Scene_Epsilon( const Real norm){
+	const Real relative = norm * Scene_Eps_Relative;
+	return (relative > Scene_Eps_in) ? relative : Scene_Eps_in;
+}
+
+//Offset a ray leaves its start surface by, kept above the hit threshold so it can not hit that surface again
+static inline Real Scene_Jump( const Real norm){
+	const Real jump = 2 * Scene_Epsilon(norm);
+	return (jump > Scene_March_Jump) ? jump : Scene_March_Jump;
+}
+
+static inline Real Body_Distance( const Body body, const Vec3 point){
 	return Shape_Distance( body.shape, point);
 }
 
 
-static inline float Scene_Distance( const Scene scene, const Vec3f point, Body **body){
-	float dist = +INFINITY;
+static inline Real Scene_Distance( const Scene scene, const Vec3 point, Body **body){
+	Real dist = +INFINITY;
 	*body = NULL;
 	for(size_t i = 0; i < scene.bodies.size; i++){
-		const float bd = Body_Distance(scene.bodies.data[i], point);
-		if(bd < dist) dist = bd;
-		if(bd <= Scene_Eps_in){
+		const Real bd = Body_Distance(scene.bodies.data[i], point);
+		if(bd < dist){
+			dist = bd;
 			*body = &scene.bodies.data[i];
-			break;
 		}
+		if(bd <= Scene_Eps_in)
+			break;
 	}
 	return dist;
 }
 
 
-static inline Vec3f Shape_Normal(const Shape shape, const Vec3f point){
+//Smallest t no less than t_min where origin + t * direction lies on the surface, false when there is none
+static inline bool Shape_Intersect( 
+		const Shape shape, 
+		const Vec3 origin, 
+		const Vec3 direction, 
+		const Real t_min, 
+		Real *const t){
+
+	switch(shape.type){
+	case SHAPE_TYPE_HALFSPACE:
+	{
+		const Real slope = Vec3Dot(shape.halfspace.normal, direction);
+		if(0.0 == slope) return false;
+		*t = (shape.halfspace.c - Vec3Dot(shape.halfspace.normal, origin)) / slope;
+		return *t >= t_min;
+	}
+	case SHAPE_TYPE_BALL:
+	{
+		const Vec3 offset = Vec3Sub(origin, shape.ball.center);
+		const Real b = Vec3Dot(offset, direction);
+		const Real disc = b * b - (Vec3Dot(offset, offset) - shape.ball.radius * shape.ball.radius);
+		if(disc < 0.0) return false;
+		const Real root = sqrt(disc);
+		*t = -b - root;
+		if(*t >= t_min) return true;
+		*t = -b + root;
+		return *t >= t_min;
+	}
+	default:
+		ERR_PRINT("Unknown Shape_Type");
+		return false;
+	}
+}
+
+static inline Vec3 Shape_Normal(const Shape shape, const Vec3 point){
 	switch (shape.type){
 	case SHAPE_TYPE_HALFSPACE:
 		return shape.halfspace.normal;
 	case SHAPE_TYPE_BALL:
-		return Vec3fNormalized(Vec3fSub(point, shape.ball.center));
+		return Vec3Normalized(Vec3Sub(point, shape.ball.center));
 	default:
 		ERR_PRINT("Unknown Shape_Type");
-		return (Vec3f){0};
+		return (Vec3){0};
 	}
 }
 
 
-static inline Vec3f Body_Normal( const Body body, const Vec3f point){
+static inline Vec3 Body_Normal( const Body body, const Vec3 point){
 	return Shape_Normal(body.shape, point);
 }
 
 
-static inline bool Scene_March( 
+//Also reports the number of steps taken, hit or not
+static inline bool Scene_MarchCounted( 
 		const Scene scene, 
-		const Vec3f start_point, 
-		const Vec3f direction, 
-		Vec3f *const endpoint, 
-		Body const**const body){
+		const Vec3 start_point, 
+		const Vec3 direction, 
+		Vec3 *const endpoint, 
+		Body const**const body,
+		size_t *const step_count){
 
 	size_t steps = 0;
-	if(Vec3fNorm(start_point) > scene.bound) return false;
-	Vec3f point = start_point;
+	*step_count = 0;
+	if(Vec3Norm(start_point) > scene.bound) return false;
+	Vec3 point = start_point;
 	Body *nearest_body;
-	float start_dist = Scene_Distance(scene, point, &nearest_body);
-	float dist = start_dist;
+	Real start_dist = Scene_Distance(scene, point, &nearest_body);
+	Real dist = start_dist;
 	/*if(start_dist < Scene_Eps_in ){
 		while(steps < Scene_Steps){
-			point = Vec3fAdd(point, Vec3fMul(direction, dist * Scene_March_Coeff));
-			if(Vec3fNorm(point) > scene.bound) return false;
+			point = Vec3Add(point, Vec3Mul(direction, dist * Scene_March_Coeff));
+			if(Vec3Norm(point) > scene.bound) return false;
 			dist = Scene_Distance( scene, point, &nearest_body);
 			if(dist < start_dist * Scene_Outfactor)
 				return false;
@@ -176,140 +312,569 @@ static inline bool Scene_March(
 			steps++;
 		}
 	}*/
-	point = Vec3fAdd(point, Vec3fMul(direction, Scene_March_Jump));
+	const Real jump = Scene_Jump(Vec3Norm(start_point));
+	point = Vec3Add(point, Vec3Mul(direction, jump));
 	steps = 0;
 	while(steps < Scene_Steps){
-		point = Vec3fAdd(point, Vec3fMul(direction, dist * Scene_March_Coeff));
-		if(Vec3fNorm(point) > scene.bound) return false;
+		point = Vec3Add(point, Vec3Mul(direction, dist * Scene_March_Coeff));
+		const Real norm = Vec3Norm(point);
+		*step_count = steps + 1;
+		if(norm > scene.bound) return false;
 		dist = Scene_Distance( scene, point, &nearest_body);
-		if(dist < Scene_Eps_in)
+		if(dist < Scene_Epsilon(norm))
 			break;
 		steps++;
 	}
-	if(steps == Scene_Steps)
-		return false;
+	//The hit point and, for rays that ran out of steps, the hit itself come from the exact surfaces,
+	//so they do not depend on how far other bodies let the ray step
+	Real t;
+	if(steps == Scene_Steps){
+		Real nearest = INFINITY;
+		nearest_body = NULL;
+		for(size_t i = 0; i < scene.bodies.size; i++){
+			if(Shape_Intersect(scene.bodies.data[i].shape, start_point, direction, jump, &t) && t < nearest){
+				nearest = t;
+				nearest_body = &scene.bodies.data[i];
+			}
+		}
+		if(!nearest_body)
+			return false;
+		point = Vec3Add(start_point, Vec3Mul(direction, nearest));
+		if(Vec3Norm(point) > scene.bound)
+			return false;
+	}else if(Body_Distance(*nearest_body, start_point) >= Scene_Epsilon(Vec3Norm(start_point))
+			&& Shape_Intersect(nearest_body->shape, start_point, direction, jump, &t)){
+		point = Vec3Add(start_point, Vec3Mul(direction, t));
+	}
 	*endpoint = point;
 	*body = nearest_body;
 	return true;
 }	
 
-//Wow, here we completely decouple the mechanics of light source from that of a surface reflectance!!!
-static inline bool Light_DirectionAndIntensity( 
+static inline bool Scene_March( 
 		const Scene scene, 
+		const Vec3 start_point, 
+		const Vec3 direction, 
+		Vec3 *const endpoint, 
+		Body const**const body){
+
+	size_t steps;
+	return Scene_MarchCounted(scene, start_point, direction, endpoint, body, &steps);
+}
+
+//Direction towards the light and its intensity at the point, no shadowing
+static inline bool Light_Incidence( 
 		const Light light, 
-		const Vec3f point, 
-		Vec3f *const direction, 
-		float *const intensity){
+		const Vec3 point, 
+		Vec3 *const direction, 
+		Real *const intensity, 
+		Real *const distance){
 
-	Vec3f direction_normalized;
-	if(Body_Distance(Bodies_get(&scene.bodies, light.source), point) < Scene_Eps_in) return false;
 	switch (light.type){
 	case LIGHT_TYPE_AFFINE:
-		*direction = direction_normalized = light.affine.direction;
+		*direction = light.affine.direction;
 		*intensity = light.affine.intensity; 
-		break;
+		*distance = INFINITY;
+		return true;
 	case LIGHT_TYPE_POINT:
 	{
-		Vec3f direction_unnormalized = Vec3fSub(light.point.center, point);
-		float dist = Vec3fNorm(direction_unnormalized);
-		*direction = direction_normalized = Vec3fNormalized(direction_unnormalized);
+		Vec3 direction_unnormalized = Vec3Sub(light.point.center, point);
+		Real dist = Vec3Norm(direction_unnormalized);
+		*direction = Vec3Normalized(direction_unnormalized);
 		*intensity = light.point.intensity/(dist * dist);
-		break;
+		*distance = dist;
+		return true;
 	}
 	default:
 		return false;
-		break;
 	}
+}
 
-	const Body* body_ptr;
-	Vec3f end_point;
-	if(!Scene_March(scene, point, direction_normalized, &end_point, &body_ptr)) return false;
+//Distance beyond which a light contributes less than cutoff, INFINITY if it has none
+static inline Real Light_InfluenceRadius( const Light light, const Real cutoff){
+	if(LIGHT_TYPE_POINT != light.type || cutoff <= 0.0)
+		return INFINITY;
+	return sqrt(light.point.intensity / cutoff);
+}
+
+//Wow, here we completely decouple the mechanics of light source from that of a surface reflectance!!!
+static inline bool Light_DirectionAndIntensity( 
+		const Scene scene, 
+		const Light light, 
+		const Vec3 point, 
+		Vec3 *const direction, 
+		Real *const intensity){
+
+	Real dist;
+	if(Body_Distance(Bodies_get(&scene.bodies, light.source), point) < Scene_Epsilon(Vec3Norm(point))) return false;
+	if(!Light_Incidence(light, point, direction, intensity, &dist)) return false;
+	if(dist > Light_InfluenceRadius(light, scene.lightSampling.cutoff)) return false;
 
-	return (body_ptr == Bodies_at(&scene.bodies,light.source));
+	const Body* body_ptr;
+	Vec3 end_point;
+	const bool hit = Scene_March(scene, point, *direction, &end_point, &body_ptr);
+	if(hit && body_ptr == Bodies_at(&scene.bodies,light.source)) return true;
+	//Whatever lies beyond a point light can not shadow it
+	if(LIGHT_TYPE_POINT == light.type)
+		return !hit || Vec3Norm(Vec3Sub(end_point, point)) >= dist;
+	return false;
 }	
 
-static inline float Body_Lighting( 
+static inline const Indices* Light_GridCell( const Scene scene, const Vec3 point){
+	const Light_Grid grid = scene.lightGrid;
+	size_t index = 0;
+	for(size_t k = 0; k < 3; k++){
+		Real c = floor((point.x[k] + grid.bound) / grid.cellSize);
+		if(c < 0.0) c = 0.0;
+		if(c > grid.resolution - 1) c = grid.resolution - 1;
+		index = index * grid.resolution + (size_t)c;
+	}
+	return &grid.cells[index];
+}
+
+static inline Real Body_LightContribution( 
+		const Scene scene, 
+		const Body body, 
+		const Light light, 
+		const Vec3 point, 
+		const Vec3 normal,
+		const Vec3 view_direction){
+
+	Vec3 light_direction;
+	Real light_intensity;
+
+	if(!Light_DirectionAndIntensity(
+				scene,
+				light,
+				point,
+				&light_direction,
+				&light_intensity))
+		return 0.0;
+
+	const Real light_normal_dot = Vec3Dot(light_direction, normal);
+
+	if(light_normal_dot <= 0.0)
+		return 0.0;
+
+	Real res = light_intensity * light_normal_dot * body.reflectionParameters.lambertCoeff;
+	
+	const Real view_normal_dot = Vec3Dot(view_direction, normal);
+	const Real view_light_dot = Vec3Dot(view_direction, light_direction);
+	const Real bounce_view_light_dot = view_light_dot - 2.0 * light_normal_dot * view_normal_dot;
+	if(bounce_view_light_dot <= 0.0)
+		return res;
+	
+	res += body.reflectionParameters.phongCoeff * pow(bounce_view_light_dot, body.reflectionParameters.phongExponent) * light_intensity;
+	return res;
+}
+
+//Unshadowed estimate used to pick lights
+static inline Real Light_Weight( 
+		const Scene scene, 
+		const Light light, 
+		const Vec3 point, 
+		const Vec3 normal){
+
+	Vec3 direction;
+	Real intensity, dist;
+	if(!Light_Incidence(light, point, &direction, &intensity, &dist)) return 0.0;
+	if(dist > Light_InfluenceRadius(light, scene.lightSampling.cutoff)) return 0.0;
+	const Real light_normal_dot = Vec3Dot(direction, normal);
+	return (light_normal_dot > 0.0) ? intensity * light_normal_dot : 0.0;
+}
+
+//Candidates are all lights, or the ones listed for the grid cell; with lightSampling.samples set
+//a fixed number of shadow rays is shot at lights chosen in proportion to their estimated contribution
+static inline Real Body_DirectLighting( 
+		const Scene scene, 
+		const Body body, 
+		const Vec3 point, 
+		const Vec3 normal,
+		const Vec3 view_direction,
+		Trace_State *const state){
+
+	const Indices *lists[2] = {NULL, NULL};
+	size_t count = 0;
+	if(scene.lightGrid.cells){
+		lists[0] = &scene.lightGrid.unbounded;
+		lists[1] = Light_GridCell(scene, point);
+		count = lists[0]->size + lists[1]->size;
+	}else{
+		count = scene.lights.size;
+	}
+#define LIGHT_CANDIDATE(n) (scene.lightGrid.cells ? \
+		(((n) < lists[0]->size) ? lists[0]->data[(n)] : lists[1]->data[(n) - lists[0]->size]) : (n))
+
+	Real res = 0.0;
+	const size_t samples = scene.lightSampling.samples;
+	if(!samples || count <= samples){
+		for( size_t i = 0; i < count; i++){ 
+			const Light* light_ptr = Lights_at(&scene.lights, LIGHT_CANDIDATE(i));
+			res += Body_LightContribution(scene, body, *light_ptr, point, normal, view_direction);
+		}
+		return res;
+	}
+
+	Real weights[count];
+	Real total = 0.0;
+	for( size_t i = 0; i < count; i++){
+		weights[i] = Light_Weight(scene, *Lights_at(&scene.lights, LIGHT_CANDIDATE(i)), point, normal);
+		total += weights[i];
+	}
+	if(total <= 0.0)
+		return 0.0;
+	//Systematic sampling, one random offset for all samples
+	const Real stride = total / samples;
+	Real next = Trace_Random(state) * stride;
+	Real cumulative = 0.0;
+	for( size_t i = 0; i < count && next < total; i++){
+		cumulative += weights[i];
+		size_t hits = 0;
+		while(next < cumulative && hits < samples){
+			hits++;
+			next += stride;
+		}
+		if(!hits)
+			continue;
+		const Light* light_ptr = Lights_at(&scene.lights, LIGHT_CANDIDATE(i));
+		res += hits * stride / weights[i] * Body_LightContribution(scene, body, *light_ptr, point, normal, view_direction);
+	}
+#undef LIGHT_CANDIDATE
+	return res;
+}
+
+//Ambient occlusion from a few distance samples along the normal, 1.0 means fully open
+static inline Real Scene_Occlusion( 
+		const Scene scene, 
+		const Vec3 point, 
+		const Vec3 normal){
+
+	const Indirect_Parameters par = scene.indirect;
+	Real occlusion = 0.0;
+	Real weight = 1.0;
+	Body *body;
+	for(size_t k = 1; k <= par.occlusionSamples; k++){
+		const Real offset = k * par.occlusionStep;
+		const Real dist = Scene_Distance(scene, Vec3Add(point, Vec3Mul(normal, offset)), &body);
+		occlusion += weight * (offset - dist);
+		weight *= 0.5;
+	}
+	const Real res = 1.0 - par.occlusionStrength * occlusion;
+	return (res < 0.0) ? 0.0 : (res > 1.0) ? 1.0 : res;
+}
+
+//One diffuse bounce: cosine weighted hemisphere samples, direct light only at the bounce points.
+//The first hit of a pixel that asks gets what is left of the per pixel budget.
+static inline Real Body_IndirectLighting( 
+		const Scene scene, 
+		const Body body, 
+		const Vec3 point, 
+		const Vec3 normal,
+		Trace_State *const state){
+
+	const size_t budget = scene.indirect.indirectSamples;
+	const size_t samples = (state->indirectSamples < budget) ? budget - state->indirectSamples : 0;
+	if(!samples)
+		return 0.0;
+	state->indirectSamples += samples;
+	const Vec3 helper = (fabs(normal.x[0]) > 0.5) ? (Vec3){{0.0, 1.0, 0.0}} : (Vec3){{1.0, 0.0, 0.0}};
+	const Vec3 tangent = Vec3Normalized(Vec3Sub(helper, Vec3Mul(normal, Vec3Dot(helper, normal))));
+	const Vec3 bitangent = {{
+		normal.x[1] * tangent.x[2] - normal.x[2] * tangent.x[1],
+		normal.x[2] * tangent.x[0] - normal.x[0] * tangent.x[2],
+		normal.x[0] * tangent.x[1] - normal.x[1] * tangent.x[0]}};
+
+	Real res = 0.0;
+	for(size_t s = 0; s < samples; s++){
+		const Real u = Trace_Random(state);
+		const Real phi = 2.0 * M_PI * Trace_Random(state);
+		const Real r = sqrt(u);
+		const Vec3 direction = Vec3Add(
+				Vec3Mul(normal, sqrt(1.0 - u)),
+				Vec3Add(
+					Vec3Mul(tangent, r * cos(phi)),
+					Vec3Mul(bitangent, r * sin(phi))));
+
+		const Body *bounce_body;
+		Vec3 bounce_point;
+		if(!Scene_March(scene, point, direction, &bounce_point, &bounce_body)) continue;
+		if(BODY_SURFACE_DARKNESS == bounce_body->surface) continue;
+		const Vec3 bounce_normal = Body_Normal(*bounce_body, bounce_point);
+		if(Vec3Dot(direction, bounce_normal) >= 0) continue;
+		res += Body_DirectLighting(scene, *bounce_body, bounce_point, bounce_normal, direction, state);
+	}
+	return body.reflectionParameters.lambertCoeff * res / samples;
+}
+
+static inline Real Body_Lighting( 
 		const Scene scene, 
 		const Body body, 
-		const Vec3f point, 
-		const Vec3f view_direction){
+		const Vec3 point, 
+		const Vec3 view_direction,
+		Trace_State *const state){
 
-	float res = 0.0;
+	Real res = 0.0;
 	if(BODY_SURFACE_DARKNESS == body.surface){
 		return 0.0;
 	}
-	const Vec3f normal = Body_Normal(body, point);
-	const float view_normal_dot = Vec3fDot(view_direction, normal);
-	//float light_normal_dot = Vec3fDot(light_direction, normal);
+	const Vec3 normal = Body_Normal(body, point);
+	const Real view_normal_dot = Vec3Dot(view_direction, normal);
+	//Real light_normal_dot = Vec3Dot(light_direction, normal);
 	if(view_normal_dot >= 0)
 		return 0.0;
 
 	res = scene.ambientLight;
-	for( size_t i = 0; i < scene.lights.size; i++){ 
-		
-		const Light* light_ptr = Lights_at(&scene.lights, i);
-		Vec3f light_direction;
-		float light_intensity;
-
-		if(!Light_DirectionAndIntensity(
-					scene,
-					*light_ptr,
-					point,
-					&light_direction,
-					&light_intensity))
-			continue;
+	if(scene.indirect.occlusionSamples)
+		res *= Scene_Occlusion(scene, point, normal);
+	res += Body_DirectLighting(scene, body, point, normal, view_direction, state);
+	if(scene.indirect.indirectSamples)
+		res += Body_IndirectLighting(scene, body, point, normal, state);
+	return res;
+}
 
-		const float light_normal_dot = Vec3fDot(light_direction, normal);
+static inline Vec3 Vec3Reflected(const Vec3 direction, const Vec3 normal){
+	return Vec3Sub(direction, Vec3Mul(normal, 2.0 * Vec3Dot(direction, normal)));
+}
 
-		if(light_normal_dot <= 0.0)
-			continue;
+//normal faces against direction, eta is the ratio of refractive indices, false on total internal reflection
+static inline bool Vec3Refracted(const Vec3 direction, const Vec3 normal, const Real eta, Vec3 *const refracted){
+	const Real cosi = -Vec3Dot(direction, normal);
+	const Real k = 1.0 - eta * eta * (1.0 - cosi * cosi);
+	if(k < 0.0) return false;
+	*refracted = Vec3Normalized(Vec3Add(Vec3Mul(direction, eta), Vec3Mul(normal, eta * cosi - sqrt(k))));
+	return true;
+}
+
+//Schlick approximation
+static inline Real Fresnel_Reflectance(const Real cosine, const Real refractiveIndex){
+	Real r0 = (1.0 - refractiveIndex) / (1.0 + refractiveIndex);
+	r0 *= r0;
+	const Real c = 1.0 - cosine;
+	return r0 + (1.0 - r0) * c * c * c * c * c;
+}
+
+//Marches from a point inside the body to its boundary, other bodies are ignored
+static inline bool Body_MarchInside( 
+		const Scene scene, 
+		const Body body, 
+		const Vec3 start_point, 
+		const Vec3 direction, 
+		Vec3 *const endpoint){
+
+	Vec3 point = Vec3Add(start_point, Vec3Mul(direction, Scene_Jump(Vec3Norm(start_point))));
+	for(size_t steps = 0; steps < Scene_Steps; steps++){
+		const Real norm = Vec3Norm(point);
+		if(norm > scene.bound) return false;
+		const Real dist = -Body_Distance(body, point);
+		if(dist < Scene_Epsilon(norm)){
+			*endpoint = point;
+			return true;
+		}
+		point = Vec3Add(point, Vec3Mul(direction, dist * Scene_March_Coeff));
+	}
+	return false;
+}
+
+static inline void Trace_Push( 
+		const Scene scene, 
+		Trace_Ray *const stack, 
+		size_t *const top, 
+		const Trace_Ray ray, 
+		Trace_State *const state){
+
+	if(ray.throughput < scene.trace.minThroughput 
+			|| ray.depth > scene.trace.maxDepth 
+			|| state->secondaryRays >= scene.trace.rayBudget
+			|| *top == SCENE_TRACE_STACK){
+		state->droppedRays++;
+		return;
+	}
+	state->secondaryRays++;
+	stack[(*top)++] = ray;
+}
+
+//Leaving a glass body: refracted outwards, the rest reflected back inside
+static inline void Trace_Exit( 
+		const Scene scene, 
+		Trace_Ray *const stack, 
+		size_t *const top, 
+		const Trace_Ray ray, 
+		Trace_State *const state){
 
-		res += light_intensity * light_normal_dot * body.reflectionParameters.lambertCoeff;
-		
-		const float view_light_dot = Vec3fDot(view_direction, light_direction);
-		const float bounce_view_light_dot = view_light_dot - 2.0 * light_normal_dot * view_normal_dot;
-		if(bounce_view_light_dot <= 0.0)
+	Vec3 exit_point;
+	if(!Body_MarchInside(scene, *ray.inside, ray.point, ray.direction, &exit_point)) return;
+	const Real ior = ray.inside->reflectionParameters.refractiveIndex;
+	const Vec3 inner_normal = Vec3Mul(Body_Normal(*ray.inside, exit_point), -1.0);
+	Vec3 refracted;
+	Real reflected_share = 1.0;
+	if(Vec3Refracted(ray.direction, inner_normal, ior, &refracted)){
+		reflected_share = Fresnel_Reflectance(Vec3Dot(refracted, Vec3Mul(inner_normal, -1.0)), ior);
+		Trace_Push(scene, stack, top, (Trace_Ray){
+				.point = exit_point,
+				.direction = refracted,
+				.throughput = ray.throughput * (1.0 - reflected_share),
+				.depth = ray.depth + 1}, state);
+	}
+	Trace_Push(scene, stack, top, (Trace_Ray){
+			.point = exit_point,
+			.direction = Vec3Reflected(ray.direction, inner_normal),
+			.throughput = ray.throughput * reflected_share,
+			.depth = ray.depth + 1,
+			.inside = ray.inside}, state);
+}
+
+//Spawns the secondary rays of a hit, returns the share left for local shading
+static inline Real Trace_Scatter( 
+		const Scene scene, 
+		Trace_Ray *const stack, 
+		size_t *const top, 
+		const Trace_Ray ray, 
+		const Body *const body, 
+		const Vec3 point, 
+		Trace_State *const state){
+
+	const Reflection_Parameters par = body->reflectionParameters;
+	switch(body->surface){
+	case BODY_SURFACE_MIRROR:
+	case BODY_SURFACE_GLOSSY:
+	{
+		const Vec3 normal = Body_Normal(*body, point);
+		if(Vec3Dot(ray.direction, normal) >= 0) return 1.0;
+		Vec3 reflected = Vec3Reflected(ray.direction, normal);
+		if(BODY_SURFACE_GLOSSY == body->surface){
+			const Vec3 jitter = {{
+				2.0 * Trace_Random(state) - 1.0,
+				2.0 * Trace_Random(state) - 1.0,
+				2.0 * Trace_Random(state) - 1.0}};
+			const Vec3 glossy = Vec3Normalized(Vec3Add(reflected, Vec3Mul(jitter, par.glossiness)));
+			if(Vec3Dot(glossy, normal) > 0.0) reflected = glossy;
+		}
+		Trace_Push(scene, stack, top, (Trace_Ray){
+				.point = point,
+				.direction = reflected,
+				.throughput = ray.throughput * par.reflectance,
+				.depth = ray.depth + 1}, state);
+		return 1.0 - par.reflectance;
+	}
+	case BODY_SURFACE_GLASS:
+	{
+		const Vec3 normal = Body_Normal(*body, point);
+		const Real cosi = -Vec3Dot(ray.direction, normal);
+		if(cosi <= 0.0) return 0.0;
+		const Real reflected_share = Fresnel_Reflectance(cosi, par.refractiveIndex);
+		Vec3 refracted;
+		if(Vec3Refracted(ray.direction, normal, 1.0 / par.refractiveIndex, &refracted)){
+			Trace_Push(scene, stack, top, (Trace_Ray){
+					.point = point,
+					.direction = refracted,
+					.throughput = ray.throughput * (1.0 - reflected_share),
+					.depth = ray.depth + 1,
+					.inside = body}, state);
+		}
+		Trace_Push(scene, stack, top, (Trace_Ray){
+				.point = point,
+				.direction = Vec3Reflected(ray.direction, normal),
+				.throughput = ray.throughput * reflected_share,
+				.depth = ray.depth + 1}, state);
+		return 0.0;
+	}
+	default:
+		return 1.0;
+	}
+}
+
+//Shades a primary hit, iterative over an explicit ray stack, secondary rays are bounded by scene.trace
+static inline Real Scene_ShadeHit( 
+		const Scene scene, 
+		const Vec3 direction,
+		const Body *const hit_body,
+		const Vec3 hit_point,
+		Trace_State *const state){
+	
+	Trace_Ray stack[SCENE_TRACE_STACK];
+	size_t top = 0;
+	const Trace_Ray primary = {.direction = direction, .throughput = 1.0};
+	Real res = 0.0;
+	const Real primary_local = Trace_Scatter(scene, stack, &top, primary, hit_body, hit_point, state);
+	if(primary_local > 0.0)
+		res += primary_local * Body_Lighting(scene, *hit_body, hit_point, direction, state);
+	while(top){
+		const Trace_Ray ray = stack[--top];
+		if(ray.inside){
+			Trace_Exit(scene, stack, &top, ray, state);
 			continue;
-		
-		res += body.reflectionParameters.phongCoeff * powf(bounce_view_light_dot, body.reflectionParameters.phongExponent) * light_intensity;
+		}
+		const Body *body_ptr;
+		Vec3 intersection;
+		if(!Scene_March(scene, ray.point, ray.direction, &intersection, &body_ptr)) continue;
+		//ERR_PRINT("not null after first scene march");
+		const Real local = Trace_Scatter(scene, stack, &top, ray, body_ptr, intersection, state);
+		if(local > 0.0)
+			res += ray.throughput * local * Body_Lighting(scene, *body_ptr, intersection, ray.direction, state);
 	}
 	return res;
 }
 
-static inline float Scene_Lighting( 
+static inline Real Scene_Lighting( 
 		const Scene scene, 
-		const Vec3f point, 
-		const Vec3f direction){
+		const Vec3 point, 
+		const Vec3 direction,
+		Trace_State *const state){
 	
 	const Body *body_ptr;
-	Vec3f first_intersection;
+	Vec3 first_intersection;
 	if(!Scene_March(scene, point, direction, &first_intersection, &body_ptr)) return 0.0;
-	//ERR_PRINT("not null after first scene march");
-	return Body_Lighting(scene, *body_ptr, first_intersection, direction);
+	return Scene_ShadeHit(scene, direction, body_ptr, first_intersection, state);
+}
+
+static inline void Camera_PrimaryRay( 
+		const Camera camera, 
+		const size_t i, 
+		const size_t j, 
+		Vec3 *const point, 
+		Vec3 *const direction){
+
+	const Vec3 unrotated = {{
+		((Real)i - (Real)camera.w/2) * camera.dx,
+		((Real)j - (Real)camera.h/2) * camera.dy,
+		camera.focus}};
+	const Vec3 rotated = Mat3Vec3Mul(camera.rotation, unrotated);
+	*direction = Vec3Normalized(rotated);
+	*point = Vec3Add(rotated, camera.position);
+}
+
+static inline void Scene_ProjectPixel( 
+		const Scene scene, 
+		const Camera camera, 
+		const size_t i, 
+		const size_t j, 
+		float* const pixels, 
+		Scene_Stats *const stats){
+
+	Vec3 point, direction;
+	Camera_PrimaryRay(camera, i, j, &point, &direction);
+	Trace_State state = Trace_Seed(camera.w * j + i);
+	Real lighting = Scene_Lighting(scene,point,direction,&state);
+	stats->secondaryRays += state.secondaryRays;
+	stats->droppedRays += state.droppedRays;
+	//if(fabs(lighting)> 0.001) fprintf(stderr, "Yay, nonzero pixel!\n");
+	pixels[3 * (camera.w * j + i) + 0] = lighting;
+	pixels[3 * (camera.w * j + i) + 1] = lighting;
+	pixels[3 * (camera.w * j + i) + 2] = lighting;
 }
 
-static inline void Scene_Project( 
+static inline Scene_Stats Scene_Project( 
 		const Scene scene, 
 		const Camera camera, 
 		float* const pixels){
 
+	Scene_Stats stats = {0};
 	for(size_t j = 0; j < camera.h; j++){
 		for(size_t i = 0; i < camera.w; i++){
-			const Vec3f unrotated = {{
-				((float)i - (float)camera.w/2) * camera.dx,
-				((float)j - (float)camera.h/2) * camera.dy,
-				camera.focus}};
-			const Vec3f rotated = Mat3fVec3fMul(camera.rotation, unrotated);
-			const Vec3f direction = Vec3fNormalized(rotated);
-			const Vec3f point = Vec3fAdd(rotated, camera.position);
-			float lighting = Scene_Lighting(scene,point,direction);
-			//if(fabs(lighting)> 0.001) fprintf(stderr, "Yay, nonzero pixel!\n");
-			pixels[3 * (camera.w * j + i) + 0] = lighting;
-			pixels[3 * (camera.w * j + i) + 1] = lighting;
-			pixels[3 * (camera.w * j + i) + 2] = lighting;
-
+			Scene_ProjectPixel(scene, camera, i, j, pixels, &stats);
 		}
 	}
+	return stats;
 }
 
 typedef struct {
@@ -318,8 +883,19 @@ typedef struct {
 	 float* pixels;
 	size_t mod;
 	size_t step;
+	const bool* tiles;	//NULL for the whole frame
+	size_t tileSize;
+	Scene_Stats stats;
 } Scene_Project_Parameters;
 
+static inline size_t Camera_TilesX( const Camera camera, const size_t tile_size){
+	return (camera.w + tile_size - 1) / tile_size;
+}
+
+static inline size_t Camera_TilesY( const Camera camera, const size_t tile_size){
+	return (camera.h + tile_size - 1) / tile_size;
+}
+
 extern void* Parallel_Scene_Project_Func( void* par ){
 
 	Scene_Project_Parameters params = *(Scene_Project_Parameters*) par;
@@ -328,79 +904,340 @@ extern void* Parallel_Scene_Project_Func( void* par ){
 	 float * const pixels = params.pixels;
 	size_t mod = params.mod;
 	size_t step = params.step;
-	for(size_t j = mod; j < camera.h; j+= step){
-		for(size_t i = 0; i < camera.w; i++){
-			const Vec3f unrotated = {{
-				((float)i - (float)camera.w/2) * camera.dx,
-				((float)j - (float)camera.h/2) * camera.dy,
-				camera.focus}};
-			const Vec3f rotated = Mat3fVec3fMul(camera.rotation, unrotated);
-			const Vec3f direction = Vec3fNormalized(rotated);
-			const Vec3f point = Vec3fAdd(rotated, camera.position);
-			float lighting = Scene_Lighting(scene,point,direction);
-			//if(fabs(lighting)> 0.001) fprintf(stderr, "Yay, nonzero pixel!\n");
-			
-			pixels[3 * (camera.w * j + i) + 0] = lighting;
-			pixels[3 * (camera.w * j + i) + 1] = lighting;
-			pixels[3 * (camera.w * j + i) + 2] = lighting;
-
+	Scene_Stats stats = {0};
+	if(params.tiles){
+		const size_t tile_size = params.tileSize;
+		const size_t tiles_x = Camera_TilesX(camera, tile_size);
+		const size_t tiles = tiles_x * Camera_TilesY(camera, tile_size);
+		size_t rank = 0;
+		for(size_t t = 0; t < tiles; t++){
+			if(!params.tiles[t] || (rank++ % step) != mod)
+				continue;
+			const size_t i0 = (t % tiles_x) * tile_size;
+			const size_t j0 = (t / tiles_x) * tile_size;
+			for(size_t j = j0; j < j0 + tile_size && j < camera.h; j++)
+				for(size_t i = i0; i < i0 + tile_size && i < camera.w; i++)
+					Scene_ProjectPixel(scene, camera, i, j, pixels, &stats);
+		}
+	}else{
+		for(size_t j = mod; j < camera.h; j+= step){
+			for(size_t i = 0; i < camera.w; i++){
+				Scene_ProjectPixel(scene, camera, i, j, pixels, &stats);
+			}
 		}
 	}
+	((Scene_Project_Parameters*) par)->stats = stats;
 	return NULL;
 }
 
-extern void Parallel_Scene_Project(
-		const Scene scene, 
-		const Camera camera, 
-		 float* const pixels,
+static inline Scene_Stats Parallel_Scene_Project_Run(
+		const Scene_Project_Parameters base_params,
 		const size_t numthreads){
 
-	Scene_Project_Parameters base_params = {
-		.scene = scene,
-		.camera = camera,
-		.pixels = pixels,
-		.step = numthreads};
 	Scene_Project_Parameters params[numthreads];
 	pthread_t tids[numthreads];
 	for(size_t i = 0; i < numthreads; i++){
 		params[i] = base_params;
 		params[i].mod = i;
+		params[i].step = numthreads;
 		pthread_create(&tids[i], NULL, Parallel_Scene_Project_Func, &params[i]);
 	}
+	Scene_Stats stats = {0};
 	for(size_t i = 0; i < numthreads; i++){
 		pthread_join(tids[i], NULL);
+		stats.secondaryRays += params[i].stats.secondaryRays;
+		stats.droppedRays += params[i].stats.droppedRays;
 	}
+	return stats;
+}
+
+extern Scene_Stats Parallel_Scene_Project(
+		const Scene scene, 
+		const Camera camera, 
+		 float* const pixels,
+		const size_t numthreads){
+
+	return Parallel_Scene_Project_Run((Scene_Project_Parameters){
+			.scene = scene,
+			.camera = camera,
+			.pixels = pixels}, numthreads);
 }
 
+//Renders only the flagged tiles, tiles are tile_size squares in row major order
+extern Scene_Stats Parallel_Scene_ProjectTiles(
+		const Scene scene, 
+		const Camera camera, 
+		 float* const pixels,
+		const bool* const tiles,
+		const size_t tile_size,
+		const size_t numthreads){
+
+	return Parallel_Scene_Project_Run((Scene_Project_Parameters){
+			.scene = scene,
+			.camera = camera,
+			.pixels = pixels,
+			.tiles = tiles,
+			.tileSize = tile_size}, numthreads);
+}
 static inline bool Scene_AddBody(Scene *scene, const Body body){
 	return Bodies_pushback(&scene->bodies, body);
 }
 
-static inline bool Scene_AddLight(Scene *scene, const Light light, const Body source){
+static inline void Light_GridDestroy( Light_Grid *grid){
+
+	if(grid->cells){
+		const size_t n = grid->resolution * grid->resolution * grid->resolution;
+		for(size_t i = 0; i < n; i++)
+			Indices_destroy(&grid->cells[i]);
+		free(grid->cells);
+	}
+	Indices_destroy(&grid->unbounded);
+	*grid = (Light_Grid){0};
+}
+
+//Replaces from with to in a cell list, from SIZE_MAX appends and to SIZE_MAX removes
+static inline bool Light_GridRename( Indices *list, const size_t from, const size_t to){
+
+	if(SIZE_MAX == from)
+		return Indices_pushback(list, to);
+	for(size_t i = 0; i < list->size; i++){
+		if(list->data[i] != from)
+			continue;
+		if(SIZE_MAX == to){
+			list->data[i] = list->data[list->size - 1];
+			return Indices_resize(list, list->size - 1);
+		}
+		list->data[i] = to;
+		return true;
+	}
+	return true;
+}
+
+//Renames the light in every cell its influence sphere touches, with the parameters the grid was built for
+static inline bool Light_GridUpdate( Light_Grid *grid, const Light light, const size_t from, const size_t to){
+
+	const Real radius = Light_InfluenceRadius(light, grid->cutoff);
+	if(!isfinite(radius) || radius >= grid->bound)
+		return Light_GridRename(&grid->unbounded, from, to);
+
+	const size_t res = grid->resolution;
+	size_t lo[3], hi[3];
+	for(size_t k = 0; k < 3; k++){
+		const Real c = light.point.center.x[k] + grid->bound;
+		const Real l = floor((c - radius) / grid->cellSize);
+		const Real h = floor((c + radius) / grid->cellSize);
+		if(h < 0.0 || l > res - 1) return true;
+		lo[k] = (l < 0.0) ? 0 : (size_t)l;
+		hi[k] = (h > res - 1) ? res - 1 : (size_t)h;
+	}
+	for(size_t i = lo[0]; i <= hi[0]; i++){
+		for(size_t j = lo[1]; j <= hi[1]; j++){
+			for(size_t k = lo[2]; k <= hi[2]; k++){
+				const size_t cell[3] = {i, j, k};
+				Real dist2 = 0.0;
+				for(size_t a = 0; a < 3; a++){
+					const Real cmin = cell[a] * grid->cellSize - grid->bound;
+					const Real cmax = cmin + grid->cellSize;
+					const Real p = light.point.center.x[a];
+					const Real d = (p < cmin) ? cmin - p : (p > cmax) ? p - cmax : 0.0;
+					dist2 += d * d;
+				}
+				if(dist2 > radius * radius)
+					continue;
+				if(!Light_GridRename(&grid->cells[(i * res + j) * res + k], from, to))
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+static inline bool Light_GridInsert( const Scene *scene, Light_Grid *grid, const size_t light_index){
+	return Light_GridUpdate(grid, Lights_get(&scene->lights, light_index), SIZE_MAX, light_index);
+}
+
+//Builds the light culling grid, shading then only visits lights listed for the cell of the shaded point
+static inline bool Scene_BuildLightGrid( Scene *scene, const size_t resolution){
+
+	Light_GridDestroy(&scene->lightGrid);
+	const size_t n = resolution * resolution * resolution;
+	Light_Grid grid = {
+		.resolution = resolution,
+		.cellSize = 2.0 * scene->bound / resolution,
+		.cutoff = scene->lightSampling.cutoff,
+		.bound = scene->bound,
+		.unbounded = Indices_create(0),
+		.cells = calloc(n, sizeof *grid.cells)};
+	bool ok = Indices_valid(&grid.unbounded) && grid.cells;
+	for(size_t i = 0; ok && i < n; i++){
+		grid.cells[i] = Indices_create(0);
+		ok = Indices_valid(&grid.cells[i]);
+	}
+	for(size_t i = 0; ok && i < scene->lights.size; i++)
+		ok = Light_GridInsert(scene, &grid, i);
+	if(!ok){
+		ERR_PRINT("Error while building light grid");
+		Light_GridDestroy(&grid);
+		return false;
+	}
+	scene->lightGrid = grid;
+	return true;
+}
+
+//Cutoff or bound changed since the grid was built, refitting it would cull with the old values
+static inline bool Light_GridStale( const Scene *scene){
+	return scene->lightGrid.cutoff != scene->lightSampling.cutoff || scene->lightGrid.bound != scene->bound;
+}
+
+//The source body must already be in the scene, several lights may share it
+static inline bool Scene_AddSharedLight(Scene *scene, const Light light){
+
+	if(light.source >= scene->bodies.size)
+		return false;
+	if(!Lights_pushback(&scene->lights, light))
+		return false;
+	if(scene->lightGrid.cells && !(Light_GridStale(scene) 
+				? Scene_BuildLightGrid(scene, scene->lightGrid.resolution)
+				: Light_GridInsert(scene, &scene->lightGrid, scene->lights.size - 1))){
+		Light_GridDestroy(&scene->lightGrid);
+		Lights_resize(&scene->lights, scene->lights.size - 1);
+		return false;
+	}
+	return true;
+}
+
+static inline bool Scene_AddLight(Scene *scene, Light light, const Body source){
 
 	if(!Scene_AddBody(scene, source))
 		return false;
-	if(!Lights_pushback(&scene->lights, light)){
+	light.source = scene->bodies.size - 1;
+	if(!Scene_AddSharedLight(scene, light)){
 		Bodies_resize(&scene->bodies, scene->bodies.size - 1);
 		return false;
 	}else{
+		return true;
+	}
+}
+
+
+//Swaps the last light into the freed slot, its source body stays in the scene
+static inline bool Scene_RemoveLight(Scene *scene, const size_t index){
+
+	if(index >= scene->lights.size)
+		return false;
+	const size_t last = scene->lights.size - 1;
+	bool ok = true;
+	const bool refit = scene->lightGrid.cells && !Light_GridStale(scene);
+	if(refit){
+		ok = Light_GridUpdate(&scene->lightGrid, Lights_get(&scene->lights, index), index, SIZE_MAX);
+		if(ok && index != last)
+			ok = Light_GridUpdate(&scene->lightGrid, Lights_get(&scene->lights, last), last, index);
+	}
+	Lights_put(&scene->lights, index, Lights_get(&scene->lights, last));
+	Lights_resize(&scene->lights, last);
+	if(ok && scene->lightGrid.cells && !refit)
+		ok = Scene_BuildLightGrid(scene, scene->lightGrid.resolution);
+	if(!ok)
+		Light_GridDestroy(&scene->lightGrid);
+	return ok;
+}
+
+//Refits the light grid for the moved light instead of rebuilding it, the source body is kept
+static inline bool Scene_UpdateLight(Scene *scene, const size_t index, Light light){
+
+	if(index >= scene->lights.size)
+		return false;
+	const Light old = Lights_get(&scene->lights, index);
+	light.source = old.source;
+	Lights_put(&scene->lights, index, light);
+	if(scene->lightGrid.cells && Light_GridStale(scene))
+		return Scene_BuildLightGrid(scene, scene->lightGrid.resolution);
+	if(scene->lightGrid.cells 
+			&& !(Light_GridUpdate(&scene->lightGrid, old, index, SIZE_MAX) 
+				&& Light_GridUpdate(&scene->lightGrid, light, SIZE_MAX, index))){
+		Light_GridDestroy(&scene->lightGrid);
 		return false;
 	}
+	return true;
+}
+
+static inline bool Scene_BodyIsSource(const Scene *scene, const size_t index){
+	for(size_t i = 0; i < scene->lights.size; i++)
+		if(Lights_at(&scene->lights, i)->source == index)
+			return true;
+	return false;
 }
 
+//Swaps the last body into the freed slot, light sources can only go with their lights
+static inline bool Scene_RemoveBody(Scene *scene, const size_t index){
+
+	if(index >= scene->bodies.size || Scene_BodyIsSource(scene, index))
+		return false;
+	const size_t last = scene->bodies.size - 1;
+	for(size_t i = 0; i < scene->lights.size; i++){
+		Light *light = Lights_at(&scene->lights, i);
+		if(light->source == last)
+			light->source = index;
+	}
+	Bodies_put(&scene->bodies, index, Bodies_get(&scene->bodies, last));
+	Bodies_resize(&scene->bodies, last);
+	return true;
+}
+
+static inline bool Scene_UpdateBody(Scene *scene, const size_t index, const Body body){
+
+	if(index >= scene->bodies.size)
+		return false;
+	Bodies_put(&scene->bodies, index, body);
+	return true;
+}
 
 static inline void Scene_Destroy( Scene *scene){
 
+	Light_GridDestroy(&scene->lightGrid);
 	Bodies_destroy(&scene->bodies);
 	Lights_destroy(&scene->lights);
 	*scene = (Scene){0};
 }	
 
-static inline bool Scene_Create( Scene *scene, const float ambientLight, const float bound){
+static inline void Shape_Translate( Shape *shape, const Vec3d shift){
+	switch(shape->type){
+	case SHAPE_TYPE_HALFSPACE: 
+		shape->halfspace.c += Vec3dDot(Vec3ToVec3d(shape->halfspace.normal), shift);
+		break;
+	case SHAPE_TYPE_BALL:
+		shape->ball.center = Vec3dToVec3(Vec3dAdd(Vec3ToVec3d(shape->ball.center), shift));
+		break;
+	default: 
+		ERR_PRINT("Unknown Shape_Type");
+		break;
+	}
+}
+
+//Moves the local zero to the world point origin, the shift is computed in double.
+//With the camera as origin, precision near it no longer depends on how far from the world zero the scene is.
+static inline bool Scene_Rebase( Scene *scene, const Vec3d origin){
+
+	const Vec3d shift = Vec3dSub(scene->origin, origin);
+	for(size_t i = 0; i < scene->bodies.size; i++)
+		Shape_Translate(&Bodies_at(&scene->bodies, i)->shape, shift);
+	for(size_t i = 0; i < scene->lights.size; i++){
+		Light *light = Lights_at(&scene->lights, i);
+		if(LIGHT_TYPE_POINT == light->type)
+			light->point.center = Vec3dToVec3(Vec3dAdd(Vec3ToVec3d(light->point.center), shift));
+	}
+	scene->origin = origin;
+	if(scene->lightGrid.cells)
+		return Scene_BuildLightGrid(scene, scene->lightGrid.resolution);
+	return true;
+}
+
+static inline bool Scene_Create( Scene *scene, const Real ambientLight, const Real bound){
 
 	*scene = (Scene){0};
 	scene->ambientLight = ambientLight;
 	scene->bound = bound;
+	scene->trace = (Trace_Parameters){.maxDepth = 4, .rayBudget = 8, .minThroughput = 0.01};
 	scene->bodies = Bodies_create(0);
 	scene->lights = Lights_create(0);
 	if(Bodies_valid(&scene->bodies) && Lights_valid(&scene->lights)){
@@ -412,7 +1249,35 @@ static inline bool Scene_Create( Scene *scene, const float ambientLight, const f
 
 }
 
-static inline Camera Camera_Create(size_t w , size_t h, float scrw){
+static inline void Scene_SetQuality( Scene *scene, const Scene_Quality quality){
+
+	Indirect_Parameters par = {0};
+	switch (quality){
+	case SCENE_QUALITY_INDIRECT_HIGH:
+		par.indirectSamples = 16;
+		par.occlusionSamples = 5;
+		break;
+	case SCENE_QUALITY_INDIRECT_LOW:
+		par.indirectSamples = 4;
+		par.occlusionSamples = 5;
+		break;
+	case SCENE_QUALITY_OCCLUSION:
+		par.occlusionSamples = 5;
+		break;
+	case SCENE_QUALITY_FLAT:
+		break;
+	default:
+		ERR_PRINT("Unknown Scene_Quality");
+		break;
+	}
+	if(par.occlusionSamples){
+		par.occlusionStep = 0.1;
+		par.occlusionStrength = 2.0;
+	}
+	scene->indirect = par;
+}
+
+static inline Camera Camera_Create(size_t w , size_t h, Real scrw){
 	return (Camera){
 		.w = w,
 		.h = h,
@@ -0,0 +1,419 @@
+//scene_edit.h
+//Live editing of a scene through stable handles, re-renders only the tiles an edit may have changed
+
+#ifndef TRACER_SCENE_EDIT_H
+#define TRACER_SCENE_EDIT_H
+
+#include <stdio.h>
+#include <string.h>
+#include "darr.h"
+#include "vec_math.h"
+#include "scene.h"
+#include "err_print.h"
+
+#define SCENE_EDIT_TILE 16
+#define SCENE_HANDLE_NONE SIZE_MAX
+
+typedef size_t Scene_Handle;
+
+typedef struct {
+	Vec3 center;
+	Real radius;
+} Bounding_Sphere;
+
+//Convex hull of two spheres, everything an edit changes lies inside the recorded regions
+typedef struct {
+	Bounding_Sphere a, b;
+} Dirty_Region;
+
+DEF_DARR_TYPE(Dirty_Region, Dirty_Regions);
+
+typedef struct {
+	Scene *scene;
+	Indices bodyIndex;	//handle to index into scene->bodies, SIZE_MAX once removed
+	Indices bodyHandle;	//index to handle
+	Indices lightIndex;
+	Indices lightHandle;
+	Dirty_Regions dirty;
+	bool dirtyAll;
+	bool rendered;
+	Camera camera;	//last rendered view
+	bool *tiles;
+	size_t tileCount;
+} Scene_Editor;
+
+static inline bool Shape_BoundingSphere( const Shape shape, Bounding_Sphere *const sphere){
+	switch(shape.type){
+	case SHAPE_TYPE_BALL:
+		*sphere = (Bounding_Sphere){.center = shape.ball.center, .radius = shape.ball.radius};
+		return true;
+	case SHAPE_TYPE_HALFSPACE:
+		return false;
+	default:
+		ERR_PRINT("Unknown Shape_Type");
+		return false;
+	}
+}
+
+//Rays that see reflections or bounce light may reach an edit from anywhere
+static inline bool Scene_HasSecondaryRays( const Scene *scene){
+	if(scene->indirect.indirectSamples)
+		return true;
+	for(size_t i = 0; i < scene->bodies.size; i++){
+		const Body_Surface surface = Bodies_at(&scene->bodies, i)->surface;
+		if(BODY_SURFACE_MIRROR == surface || BODY_SURFACE_GLOSSY == surface || BODY_SURFACE_GLASS == surface)
+			return true;
+	}
+	return false;
+}
+
+static inline bool Camera_Equal( const Camera a, const Camera b){
+	if(a.w != b.w || a.h != b.h || a.dx != b.dx || a.dy != b.dy || a.focus != b.focus)
+		return false;
+	for(size_t i = 0; i < 3; i++){
+		if(a.position.x[i] != b.position.x[i])
+			return false;
+		for(size_t j = 0; j < 3; j++)
+			if(a.rotation.x[i][j] != b.rotation.x[i][j])
+				return false;
+	}
+	return true;
+}
+
+//Pixel rectangle [i0, i1) x [j0, j1) covering the sphere, false when it reaches behind the camera.
+//Assumes an orthonormal camera rotation.
+static inline bool Camera_ProjectSphere(
+		const Camera camera,
+		const Bounding_Sphere sphere,
+		Real rect[static 4]){
+
+	const Vec3 q = Mat3Vec3Mul(Mat3Transposed(camera.rotation), Vec3Sub(sphere.center, camera.position));
+	const Real r = sphere.radius;
+	if(q.x[2] - r <= 0.0)
+		return false;
+	const Real scale[2] = {camera.focus / camera.dx, camera.focus / camera.dy};
+	const Real half[2] = {(Real)camera.w / 2, (Real)camera.h / 2};
+	for(size_t a = 0; a < 2; a++){
+		Real lo = INFINITY, hi = -INFINITY;
+		for(int sx = -1; sx <= 1; sx += 2){
+			for(int sz = -1; sz <= 1; sz += 2){
+				const Real p = (q.x[a] + sx * r) / (q.x[2] + sz * r) * scale[a] + half[a];
+				if(p < lo) lo = p;
+				if(p > hi) hi = p;
+			}
+		}
+		rect[2 * a] = lo - 1.0;
+		rect[2 * a + 1] = hi + 2.0;
+	}
+	return true;
+}
+
+//Flags the tiles a region projects to, false when it can not be bounded on screen
+static inline bool Dirty_RegionTiles(
+		const Camera camera,
+		const Dirty_Region region,
+		bool *const tiles){
+
+	Real ra[4], rb[4];
+	if(!Camera_ProjectSphere(camera, region.a, ra) || !Camera_ProjectSphere(camera, region.b, rb))
+		return false;
+	const size_t tiles_x = Camera_TilesX(camera, SCENE_EDIT_TILE);
+	const size_t limit[2] = {camera.w, camera.h};
+	size_t lo[2], hi[2];
+	for(size_t a = 0; a < 2; a++){
+		Real l = (ra[2 * a] < rb[2 * a]) ? ra[2 * a] : rb[2 * a];
+		Real h = (ra[2 * a + 1] > rb[2 * a + 1]) ? ra[2 * a + 1] : rb[2 * a + 1];
+		if(h <= 0.0 || l >= limit[a])
+			return true;
+		if(l < 0.0) l = 0.0;
+		if(h > limit[a]) h = limit[a];
+		lo[a] = (size_t)l / SCENE_EDIT_TILE;
+		hi[a] = ((size_t)ceil(h) - 1) / SCENE_EDIT_TILE;
+	}
+	for(size_t j = lo[1]; j <= hi[1]; j++)
+		for(size_t i = lo[0]; i <= hi[0]; i++)
+			tiles[j * tiles_x + i] = true;
+	return true;
+}
+
+static inline void Scene_EditorMarkAll( Scene_Editor *editor){
+	editor->dirtyAll = true;
+}
+
+static inline void Scene_EditorMarkRegion( Scene_Editor *editor, const Bounding_Sphere a, const Bounding_Sphere b){
+	if(!Dirty_Regions_pushback(&editor->dirty, (Dirty_Region){a, b}))
+		editor->dirtyAll = true;
+}
+
+//The body itself, the ambient occlusion reach around it and the shadows it casts
+static inline void Scene_EditorMarkBody( Scene_Editor *editor, const Body body){
+
+	const Scene *scene = editor->scene;
+	Bounding_Sphere sphere;
+	if(!Shape_BoundingSphere(body.shape, &sphere)){
+		Scene_EditorMarkAll(editor);
+		return;
+	}
+	//An occlusion sample sits up to the reach above its surface point and sees bodies up to the reach further
+	sphere.radius += 2 * scene->indirect.occlusionSamples * scene->indirect.occlusionStep;
+	Scene_EditorMarkRegion(editor, sphere, sphere);
+
+	for(size_t i = 0; i < scene->lights.size; i++){
+		const Light light = Lights_get(&scene->lights, i);
+		if(LIGHT_TYPE_AFFINE == light.type){
+			const Bounding_Sphere far = {
+				.center = Vec3Sub(sphere.center, Vec3Mul(light.affine.direction, 2.0 * scene->bound)),
+				.radius = sphere.radius};
+			Scene_EditorMarkRegion(editor, sphere, far);
+			continue;
+		}
+		const Vec3 apex = light.point.center;
+		const Vec3 axis = Vec3Sub(sphere.center, apex);
+		const Real dist = Vec3Norm(axis);
+		if(dist <= sphere.radius){
+			Scene_EditorMarkAll(editor);
+			return;
+		}
+		const Real influence = Light_InfluenceRadius(light, scene->lightSampling.cutoff);
+		if(dist - sphere.radius > influence)
+			continue;
+		Real reach = Vec3Norm(apex) + scene->bound;
+		if(influence < reach) reach = influence;
+		Real scale = reach / (dist - sphere.radius);
+		if(scale < 1.0) scale = 1.0;
+		const Bounding_Sphere behind = {
+			.center = Vec3Add(apex, Vec3Mul(axis, scale)),
+			.radius = sphere.radius * scale};
+		Scene_EditorMarkRegion(editor, sphere, behind);
+	}
+}
+
+//Everything the light reaches
+static inline void Scene_EditorMarkLight( Scene_Editor *editor, const Light light){
+
+	const Real influence = Light_InfluenceRadius(light, editor->scene->lightSampling.cutoff);
+	if(!isfinite(influence)){
+		Scene_EditorMarkAll(editor);
+		return;
+	}
+	const Bounding_Sphere sphere = {.center = light.point.center, .radius = influence};
+	Scene_EditorMarkRegion(editor, sphere, sphere);
+}
+
+static inline void Scene_EditorDestroy( Scene_Editor *editor){
+
+	Indices_destroy(&editor->bodyIndex);
+	Indices_destroy(&editor->bodyHandle);
+	Indices_destroy(&editor->lightIndex);
+	Indices_destroy(&editor->lightHandle);
+	Dirty_Regions_destroy(&editor->dirty);
+	free(editor->tiles);
+	*editor = (Scene_Editor){0};
+}
+
+//The editor does not own the scene, bodies and lights already in it get handles equal to their indices
+static inline bool Scene_EditorCreate( Scene_Editor *editor, Scene *scene){
+
+	*editor = (Scene_Editor){
+		.scene = scene,
+		.bodyIndex = Indices_create(scene->bodies.size),
+		.bodyHandle = Indices_create(scene->bodies.size),
+		.lightIndex = Indices_create(scene->lights.size),
+		.lightHandle = Indices_create(scene->lights.size),
+		.dirty = Dirty_Regions_create(0),
+		.dirtyAll = true};
+	if(!(Indices_valid(&editor->bodyIndex) && Indices_valid(&editor->bodyHandle)
+				&& Indices_valid(&editor->lightIndex) && Indices_valid(&editor->lightHandle)
+				&& Dirty_Regions_valid(&editor->dirty))){
+		ERR_PRINT("Error while creating scene editor");
+		Scene_EditorDestroy(editor);
+		return false;
+	}
+	for(size_t i = 0; i < scene->bodies.size; i++){
+		Indices_put(&editor->bodyIndex, i, i);
+		Indices_put(&editor->bodyHandle, i, i);
+	}
+	for(size_t i = 0; i < scene->lights.size; i++){
+		Indices_put(&editor->lightIndex, i, i);
+		Indices_put(&editor->lightHandle, i, i);
+	}
+	return true;
+}
+
+static inline size_t Scene_EditorBodyIndex( const Scene_Editor *editor, const Scene_Handle handle){
+	return (handle < editor->bodyIndex.size) ? Indices_get(&editor->bodyIndex, handle) : SIZE_MAX;
+}
+
+static inline size_t Scene_EditorLightIndex( const Scene_Editor *editor, const Scene_Handle handle){
+	return (handle < editor->lightIndex.size) ? Indices_get(&editor->lightIndex, handle) : SIZE_MAX;
+}
+
+//Handle for the body just appended to the scene
+static inline Scene_Handle Scene_EditorTrackBody( Scene_Editor *editor){
+
+	const Scene_Handle handle = editor->bodyIndex.size;
+	if(!Indices_pushback(&editor->bodyIndex, editor->scene->bodies.size - 1))
+		return SCENE_HANDLE_NONE;
+	if(!Indices_pushback(&editor->bodyHandle, handle)){
+		Indices_resize(&editor->bodyIndex, handle);
+		return SCENE_HANDLE_NONE;
+	}
+	return handle;
+}
+
+static inline bool Scene_EditorEraseBody( Scene_Editor *editor, const size_t index){
+
+	const size_t last = editor->scene->bodies.size - 1;
+	if(!Scene_RemoveBody(editor->scene, index))
+		return false;
+	Indices_put(&editor->bodyIndex, Indices_get(&editor->bodyHandle, index), SIZE_MAX);
+	if(index != last){
+		const Scene_Handle moved = Indices_get(&editor->bodyHandle, last);
+		Indices_put(&editor->bodyIndex, moved, index);
+		Indices_put(&editor->bodyHandle, index, moved);
+	}
+	Indices_resize(&editor->bodyHandle, last);
+	return true;
+}
+
+static inline Scene_Handle Scene_EditorAddBody( Scene_Editor *editor, const Body body){
+
+	if(!Scene_AddBody(editor->scene, body))
+		return SCENE_HANDLE_NONE;
+	const Scene_Handle handle = Scene_EditorTrackBody(editor);
+	if(SCENE_HANDLE_NONE == handle){
+		Bodies_resize(&editor->scene->bodies, editor->scene->bodies.size - 1);
+		return SCENE_HANDLE_NONE;
+	}
+	Scene_EditorMarkBody(editor, body);
+	return handle;
+}
+
+static inline bool Scene_EditorUpdateBody( Scene_Editor *editor, const Scene_Handle handle, const Body body){
+
+	const size_t index = Scene_EditorBodyIndex(editor, handle);
+	if(SIZE_MAX == index)
+		return false;
+	Scene_EditorMarkBody(editor, Bodies_get(&editor->scene->bodies, index));
+	if(!Scene_UpdateBody(editor->scene, index, body))
+		return false;
+	Scene_EditorMarkBody(editor, body);
+	return true;
+}
+
+//Light sources go away with their lights only
+static inline bool Scene_EditorRemoveBody( Scene_Editor *editor, const Scene_Handle handle){
+
+	const size_t index = Scene_EditorBodyIndex(editor, handle);
+	if(SIZE_MAX == index || Scene_BodyIsSource(editor->scene, index))
+		return false;
+	Scene_EditorMarkBody(editor, Bodies_get(&editor->scene->bodies, index));
+	return Scene_EditorEraseBody(editor, index);
+}
+
+static inline Scene_Handle Scene_EditorAddLight( Scene_Editor *editor, const Light light, const Body source){
+
+	Scene *scene = editor->scene;
+	if(!Scene_AddLight(scene, light, source))
+		return SCENE_HANDLE_NONE;
+	const Scene_Handle handle = editor->lightIndex.size;
+	if(SCENE_HANDLE_NONE == Scene_EditorTrackBody(editor)
+			|| !Indices_pushback(&editor->lightIndex, scene->lights.size - 1)
+			|| !Indices_pushback(&editor->lightHandle, handle)){
+		ERR_PRINT("Error while tracking light, handles are no longer valid");
+		Scene_EditorMarkAll(editor);
+		return SCENE_HANDLE_NONE;
+	}
+	Scene_EditorMarkBody(editor, source);
+	Scene_EditorMarkLight(editor, Lights_get(&scene->lights, scene->lights.size - 1));
+	return handle;
+}
+
+//A point light takes its source body along unless other lights share it
+static inline bool Scene_EditorUpdateLight( Scene_Editor *editor, const Scene_Handle handle, const Light light){
+
+	Scene *scene = editor->scene;
+	const size_t index = Scene_EditorLightIndex(editor, handle);
+	if(SIZE_MAX == index)
+		return false;
+	const Light old = Lights_get(&scene->lights, index);
+	Scene_EditorMarkLight(editor, old);
+	Scene_EditorMarkLight(editor, light);
+	size_t users = 0;
+	for(size_t i = 0; i < scene->lights.size; i++)
+		users += (Lights_at(&scene->lights, i)->source == old.source);
+	if(1 == users && LIGHT_TYPE_POINT == old.type && LIGHT_TYPE_POINT == light.type){
+		Body source = Bodies_get(&scene->bodies, old.source);
+		Scene_EditorMarkBody(editor, source);
+		Shape_Translate(&source.shape, Vec3ToVec3d(Vec3Sub(light.point.center, old.point.center)));
+		Scene_UpdateBody(scene, old.source, source);
+		Scene_EditorMarkBody(editor, source);
+	}
+	return Scene_UpdateLight(scene, index, light);
+}
+
+//Also removes the source body once no other light uses it
+static inline bool Scene_EditorRemoveLight( Scene_Editor *editor, const Scene_Handle handle){
+
+	Scene *scene = editor->scene;
+	const size_t index = Scene_EditorLightIndex(editor, handle);
+	if(SIZE_MAX == index)
+		return false;
+	const Light light = Lights_get(&scene->lights, index);
+	Scene_EditorMarkLight(editor, light);
+	const size_t last = scene->lights.size - 1;
+	const bool ok = Scene_RemoveLight(scene, index);
+	Indices_put(&editor->lightIndex, handle, SIZE_MAX);
+	if(index != last){
+		const Scene_Handle moved = Indices_get(&editor->lightHandle, last);
+		Indices_put(&editor->lightIndex, moved, index);
+		Indices_put(&editor->lightHandle, index, moved);
+	}
+	Indices_resize(&editor->lightHandle, last);
+	if(!Scene_BodyIsSource(scene, light.source)){
+		Scene_EditorMarkBody(editor, Bodies_get(&scene->bodies, light.source));
+		Scene_EditorEraseBody(editor, light.source);
+	}
+	return ok;
+}
+
+//Renders the tiles touched since the last call, everything when the camera moved.
+//Returns the number of tiles rendered. Tiles left alone match a full render up to round-off of the hit points.
+static inline size_t Scene_EditorRender(
+		Scene_Editor *editor,
+		const Camera camera,
+		float* const pixels,
+		const size_t numthreads){
+
+	const size_t count = Camera_TilesX(camera, SCENE_EDIT_TILE) * Camera_TilesY(camera, SCENE_EDIT_TILE);
+	if(count != editor->tileCount){
+		bool *tiles = realloc(editor->tiles, count * sizeof *tiles);
+		if(!tiles){
+			ERR_PRINT("Error while allocating tiles");
+			return 0;
+		}
+		editor->tiles = tiles;
+		editor->tileCount = count;
+		editor->rendered = false;
+	}
+	bool all = editor->dirtyAll || !editor->rendered || !Camera_Equal(camera, editor->camera)
+		|| (editor->dirty.size && Scene_HasSecondaryRays(editor->scene));
+	memset(editor->tiles, 0, count * sizeof *editor->tiles);
+	for(size_t i = 0; !all && i < editor->dirty.size; i++)
+		all = !Dirty_RegionTiles(camera, Dirty_Regions_get(&editor->dirty, i), editor->tiles);
+	size_t rendered = 0;
+	for(size_t i = 0; i < count; i++){
+		if(all) editor->tiles[i] = true;
+		rendered += editor->tiles[i];
+	}
+	if(rendered)
+		Parallel_Scene_ProjectTiles(*editor->scene, camera, pixels, editor->tiles, SCENE_EDIT_TILE, numthreads);
+
+	Dirty_Regions_resize(&editor->dirty, 0);
+	editor->dirtyAll = false;
+	editor->rendered = true;
+	editor->camera = camera;
+	return rendered;
+}
+
+#endif
@@ -0,0 +1,159 @@
+//scenes.h
+//Canonical scenes shared by the viewer and the benchmark
+
+#ifndef TRACER_SCENES_H
+#define TRACER_SCENES_H
+
+#include "scene.h"
+#include "vec_math.h"
+
+static inline Camera Scenes_DemoCamera( size_t w, size_t h){
+	Camera camera = Camera_Create( w, h, 0.5);
+	camera.focus = 0.5;
+	camera.rotation = Mat3_Unity;
+	camera.position = (Vec3){0};
+	return camera;
+}
+
+//Floor and the two balls of the demo, shared by the canonical scenes
+static inline bool Scenes_AddDemoBodies( Scene *scene){
+
+	Reflection_Parameters smooth_ha = {.phongCoeff = 1.0, .lambertCoeff = 0.9, .phongExponent = 4.0};	
+	Reflection_Parameters smooth_la = {.phongCoeff = 0.7, .lambertCoeff = 0.2, .phongExponent = 4.0};
+	bool ok = Scene_AddBody(
+			scene,
+			(Body){
+			.surface = BODY_SURFACE_SMOOTH,
+			.shape.type = SHAPE_TYPE_HALFSPACE,
+			.shape.halfspace.normal = {{0.0, 1.0, 0.0}},
+			.shape.halfspace.c = - 3.0,
+			.reflectionParameters = smooth_la});
+	ok = ok && Scene_AddBody(
+			scene,
+			(Body){
+			.surface = BODY_SURFACE_SMOOTH,
+			.shape.type = SHAPE_TYPE_BALL,
+			.reflectionParameters = smooth_ha,
+			.shape.ball.center = {{0.0, 0.0, 8.5}},
+			.shape.ball.radius = 0.2});
+	ok = ok && Scene_AddBody(
+			scene,
+			(Body){
+			.surface = BODY_SURFACE_SMOOTH,
+			.shape.type = SHAPE_TYPE_BALL,
+			.reflectionParameters = smooth_ha,
+			.shape.ball.center = {{0.0, -1.0, 9.0}},
+			.shape.ball.radius = 0.5});
+	return ok;
+}
+
+static inline bool Scenes_Demo( Scene *scene){
+
+	if(!Scene_Create(scene, 0.1, 100.0))
+		return false;
+	/*Scene_AddLight(
+			scene, 
+			(Light){
+			.type = LIGHT_TYPE_AFFINE,
+			.affine.direction = Vec3Normalized((Vec3){{0.3, 1.0, 0.3}}),
+			.affine.intensity = 1.0},
+			(Body){
+			.surface = BODY_SURFACE_DARKNESS,
+			.shape.type = SHAPE_TYPE_HALFSPACE,
+			.shape.halfspace.normal = {{0.0, -1.0, 0.0}},
+			.shape.halfspace.c = -10.0});*/
+	Scene_AddLight(
+			scene, 
+			(Light){
+			.type = LIGHT_TYPE_POINT,
+			.point.center = {{5.0, 15.0, -5.0 }},
+			.point.intensity = 400.0},
+			(Body){
+			.surface = BODY_SURFACE_DARKNESS,
+			.shape.type = SHAPE_TYPE_HALFSPACE,
+			.shape.halfspace.normal = {{0.0, -1.0, 0.0}},
+			.shape.halfspace.c = -10.0});
+
+	const bool ok = Scenes_AddDemoBodies(scene);
+	if(!ok){
+		ERR_PRINT("Error while building demo scene");
+		Scene_Destroy(scene);
+	}
+	return ok;
+}
+
+//Demo bodies lit by count point lights in a square lattice under the ceiling, all sharing its body as source
+static inline bool Scenes_ManyLights( Scene *scene, const size_t count){
+
+	if(!Scene_Create(scene, 0.1, 100.0))
+		return false;
+	bool ok = Scene_AddBody(
+			scene,
+			(Body){
+			.surface = BODY_SURFACE_DARKNESS,
+			.shape.type = SHAPE_TYPE_HALFSPACE,
+			.shape.halfspace.normal = {{0.0, -1.0, 0.0}},
+			.shape.halfspace.c = -10.0});
+	const size_t ceiling = scene->bodies.size - 1;
+	size_t side = 1;
+	while(side * side < count) side++;
+	const Real extent = 16.0;
+	for(size_t i = 0; ok && i < count; i++){
+		const Real u = (side > 1) ? (Real)(i % side) / (side - 1) : 0.5;
+		const Real v = (side > 1) ? (Real)(i / side) / (side - 1) : 0.5;
+		ok = Scene_AddSharedLight(
+				scene, 
+				(Light){
+				.type = LIGHT_TYPE_POINT,
+				.source = ceiling,
+				.point.center = {{(u - 0.5) * extent, 1.0 + (i % 3), 9.0 + (v - 0.5) * extent}},
+				.point.intensity = 4.0});
+	}
+	ok = ok && Scenes_AddDemoBodies(scene);
+	if(!ok){
+		ERR_PRINT("Error while building many lights scene");
+		Scene_Destroy(scene);
+	}
+	return ok;
+}
+
+//Mirror, glossy and glass balls over the demo floor
+static inline bool Scenes_Reflective( Scene *scene){
+
+	if(!Scenes_Demo(scene))
+		return false;
+	Reflection_Parameters mirror = {.phongCoeff = 0.5, .lambertCoeff = 0.1, .phongExponent = 16.0, .reflectance = 0.8};
+	Reflection_Parameters glossy = {.phongCoeff = 0.5, .lambertCoeff = 0.3, .phongExponent = 8.0, .reflectance = 0.5, .glossiness = 0.1};
+	Reflection_Parameters glass = {.phongCoeff = 0.0, .lambertCoeff = 0.0, .refractiveIndex = 1.5};
+	bool ok = Scene_AddBody(
+			scene,
+			(Body){
+			.surface = BODY_SURFACE_MIRROR,
+			.shape.type = SHAPE_TYPE_BALL,
+			.reflectionParameters = mirror,
+			.shape.ball.center = {{-1.5, -0.5, 9.5}},
+			.shape.ball.radius = 0.7});
+	ok = ok && Scene_AddBody(
+			scene,
+			(Body){
+			.surface = BODY_SURFACE_GLOSSY,
+			.shape.type = SHAPE_TYPE_BALL,
+			.reflectionParameters = glossy,
+			.shape.ball.center = {{1.5, -0.6, 9.5}},
+			.shape.ball.radius = 0.6});
+	ok = ok && Scene_AddBody(
+			scene,
+			(Body){
+			.surface = BODY_SURFACE_GLASS,
+			.shape.type = SHAPE_TYPE_BALL,
+			.reflectionParameters = glass,
+			.shape.ball.center = {{0.6, -0.2, 7.0}},
+			.shape.ball.radius = 0.35});
+	if(!ok){
+		ERR_PRINT("Error while building reflective scene");
+		Scene_Destroy(scene);
+	}
+	return ok;
+}
+
+#endif
@@ -2,109 +2,145 @@
 #define VEC_MATH_H
 
 #include <math.h>
+#include <float.h>
 #include <stddef.h>
 #include <stdbool.h>
 #include "err_print.h"
 
+//Generates the 3d vector and matrix kernels for one scalar type
+#define DEF_VEC3_TYPE(scalar, sqrt_func, vec, mat) \
+	typedef struct {\
+		scalar x[3];\
+	} vec;\
+	\
+	typedef struct {\
+		scalar x[3][3];\
+	} mat;\
+	\
+	static const mat mat##_Unity = {.x = {\
+		{1.0, 0.0, 0.0},\
+		{0.0, 1.0, 0.0},\
+		{0.0, 0.0, 1.0}}};\
+	\
+	static inline vec ArrTo##vec( const scalar a[static 3]){\
+		return (vec){{a[0], a[1], a[2]}};\
+	}\
+	\
+	static inline void vec##ToArr( scalar a[], const vec v){\
+		for(size_t i = 0; i < 3; i++) a[i] = v.x[i];\
+	}\
+	\
+	static inline scalar vec##Dot(const vec a, const vec b){\
+		scalar res = 0.0;\
+		for(size_t i = 0; i < 3; i++) res+= a.x[i] * b.x[i];\
+		return res;\
+	}\
+	\
+	static inline scalar vec##Norm(const vec a){\
+		return sqrt_func(vec##Dot(a,a));\
+	}\
+	\
+	static inline vec vec##Mul(const vec a, const scalar b){\
+		vec res = a;\
+		for(size_t i = 0; i < 3; i++) res.x[i] *= b;\
+		return res;\
+	}\
+	\
+	static inline vec vec##Add(const vec a, const vec b){\
+		vec res = a;\
+		for(size_t i = 0; i < 3; i++) res.x[i]+= b.x[i];\
+		return res;\
+	}\
+	\
+	static inline vec vec##Sub(const vec a, const vec b){\
+		vec res = a;\
+		for(size_t i = 0; i < 3; i++) res.x[i]-= b.x[i];\
+		return res;\
+	}\
+	\
+	static inline vec vec##PMul(const vec a, const vec b){\
+		vec res = a;\
+		for(size_t i = 0; i < 3; i++) res.x[i]*= b.x[i];\
+		return res;\
+	}\
+	\
+	static inline vec vec##Normalized(const vec a){\
+		scalar norm = vec##Norm(a);\
+		return vec##Mul(a, 1.0/norm);\
+	}\
+	\
+	static inline vec mat##vec##Mul( const mat a, const vec b){\
+		vec res;\
+		for(size_t i = 0; i < 3; i++) res.x[i] = vec##Dot(ArrTo##vec(a.x[i]), b);\
+		return res;\
+	\
+	}\
+	\
+	static inline mat mat##mat##Mul( const mat a, const mat b){\
+		mat res = {0};\
+		for(size_t i = 0; i < 3; i++){\
+			for(size_t j = 0; j < 3; j++){\
+				for(size_t k = 0; k < 3; k++){\
+					res.x[i][j] += a.x[i][k] * b.x[k][j];\
+				}\
+			}\
+		}\
+		return res;\
+	}\
+	\
+	static inline mat mat##Transposed( const mat a){\
+		mat res;\
+		for(size_t i = 0; i < 3; i++)\
+			for(size_t j = 0; j < 3; j++)\
+				res.x[i][j] = a.x[j][i];\
+		return res;\
+	}\
+	\
+	static inline mat mat##Unitarised( const mat a, bool *tok){\
+		mat res = a;\
+		vec tres[3];\
+		for(size_t i = 0; i < 3; i++) tres[i] = ArrTo##vec(a.x[i]);\
+		for( size_t i = 0; i < 3; i++){\
+			if(vec##Norm(tres[i]) == 0.0) {\
+				VEC_MATH_DEBUG_PRINT("Matrix unitarisation failed, zero norm");\
+				if(tok) *tok = false;\
+				return res;\
+			}\
+			tres[i] = vec##Normalized(tres[i]);\
+			for(size_t j = i ; j < 3; j++){\
+				tres[j] = vec##Add( tres[j], vec##Mul( tres[i], -vec##Dot(tres[i], tres[j])));\
+			}\
+		}\
+		for(size_t i = 0 ; i < 3; i++) vec##ToArr(res.x[i], tres[i]);\
+		return res;\
+	}\
 
-typedef struct {
-	float x[3];
-} Vec3f;
-
-typedef struct {
-	float x[3][3];
-} Mat3f;
-
-static const Mat3f Mat3f_Unity = {.x = {
-	{1.0, 0.0, 0.0},
-	{0.0, 1.0, 0.0},
-	{0.0, 0.0, 1.0}}};
-
-static inline Vec3f ArrToVec3f( const float a[static 3]){
-	return (Vec3f){{a[0], a[1], a[2]}};
-}
-
-static inline void Vec3fToArr( float a[], const Vec3f v){
-	for(size_t i = 0; i < 3; i++) a[i] = v.x[i];
-}
-
-static inline float Vec3fDot(const Vec3f a, const Vec3f b){
-	float res = 0.0;
-	for(size_t i = 0; i < 3; i++) res+= a.x[i] * b.x[i];
-	return res;
-}
-
-static inline float Vec3fNorm(const Vec3f a){
-	return sqrtf(Vec3fDot(a,a));
-}
-
-static inline Vec3f Vec3fMul(const Vec3f a, const float b){
-	Vec3f res = a;
-	for(size_t i = 0; i < 3; i++) res.x[i] *= b;
-	return res;
-}
-
-static inline Vec3f Vec3fAdd(const Vec3f a, const Vec3f b){
-	Vec3f res = a;
-	for(size_t i = 0; i < 3; i++) res.x[i]+= b.x[i];
-	return res;
-}
-
-static inline Vec3f Vec3fSub(const Vec3f a, const Vec3f b){
-	Vec3f res = a;
-	for(size_t i = 0; i < 3; i++) res.x[i]-= b.x[i];
-	return res;
-}
-
-static inline Vec3f Vec3fPMul(const Vec3f a, const Vec3f b){
-	Vec3f res = a;
-	for(size_t i = 0; i < 3; i++) res.x[i]*= b.x[i];
-	return res;
-}
-
-static inline Vec3f Vec3fNormalized(const Vec3f a){
-	float norm = Vec3fNorm(a);
-	return Vec3fMul(a, 1.0/norm);
-}
-
-static inline Vec3f Mat3fVec3fMul( const Mat3f a, const Vec3f b){
-	Vec3f res;
-	for(size_t i = 0; i < 3; i++) res.x[i] = Vec3fDot(ArrToVec3f(a.x[i]), b);
-	return res;
+#ifdef DEBUG 
+#define VEC_MATH_DEBUG_PRINT(x) ERR_PRINT(x)
+#else
+#define VEC_MATH_DEBUG_PRINT(x)
+#endif
 
-}
+DEF_VEC3_TYPE(float, sqrtf, Vec3f, Mat3f)
+DEF_VEC3_TYPE(double, sqrt, Vec3d, Mat3d)
+
+//Scalar the tracer computes in, float unless built with TRACER_DOUBLE
+#ifdef TRACER_DOUBLE
+typedef double Real;
+#define REAL_EPSILON DBL_EPSILON
+DEF_VEC3_TYPE(double, sqrt, Vec3, Mat3)
+#else
+typedef float Real;
+#define REAL_EPSILON FLT_EPSILON
+DEF_VEC3_TYPE(float, sqrtf, Vec3, Mat3)
+#endif
 
-static inline Mat3f Mat3fMat3fMul( const Mat3f a, const Mat3f b){
-	Mat3f res;
-	for(size_t i = 0; i < 3; i++){
-		for(size_t j = 0; j < 3; j++){
-			for(size_t k = 0; k < 3; k++){
-				res.x[i][j] = a.x[i][k] * b.x[k][j];
-			}
-		}
-	}
-	return res;
+static inline Vec3d Vec3ToVec3d( const Vec3 v){
+	return (Vec3d){{v.x[0], v.x[1], v.x[2]}};
 }
 
-static inline Mat3f Mat3fUnitarised( const Mat3f a, bool *tok){
-	Mat3f res = a;
-	Vec3f tres[3];
-	for(size_t i = 0; i < 3; i++) tres[i] = ArrToVec3f(a.x[i]);
-	for( size_t i = 0; i < 3; i++){
-		if(Vec3fNorm(tres[i]) == 0.0) {
-#ifdef DEBUG 
-			ERR_PRINT("Matrix unitarisation failed, zero norm");
-#endif
-			if(tok) *tok = false;
-			return res;
-		}
-		tres[i] = Vec3fNormalized(tres[i]);
-		for(size_t j = i ; j < 3; j++){
-			tres[j] = Vec3fAdd( tres[j], Vec3fMul( tres[i], -Vec3fDot(tres[i], tres[j])));
-		}
-	}
-	for(size_t i = 0 ; i < 3; i++) Vec3fToArr(res.x[i], tres[i]);
-	return res;
+static inline Vec3 Vec3dToVec3( const Vec3d v){
+	return (Vec3){{v.x[0], v.x[1], v.x[2]}};
 }
 
 #endif